@@ -8,6 +8,9 @@
 #include "objects.h"
 #include "mesh.h"
 #include <map>
+#include <chrono>
+#include "triangle.h"
+#include "simd.h"
 
 class TriObj;
 
@@ -41,17 +44,22 @@ public:
     
     float data[6] = {BIGFLOAT, BIGFLOAT, BIGFLOAT, -BIGFLOAT, -BIGFLOAT, -BIGFLOAT};
 
-    Vec3f GetMax()
+    Vec3f GetMax() const
     {
         return Vec3f(data[3], data[4], data[5]);
     }
     
-    Vec3f GetMin()
+    Vec3f GetMin() const
     {
         return Vec3f(data[0], data[1], data[2]);
     }
     
-    float SurfaceArea()
+    Vec3f GetCenter() const
+    {
+        return Vec3f(data[0] + data[3], data[1] + data[4], data[2] + data[5]) * 0.5f;
+    }
+    
+    float SurfaceArea() const
     {
         Vec3f lengthVector = GetMax() - GetMin();
         return lengthVector.x * lengthVector.y * 2.0f + lengthVector.x * lengthVector.z * 2.0f + lengthVector.y * lengthVector.z * 2.0f;
@@ -85,6 +93,21 @@ public:
         }
     }
     
+    void UpdateByBound(const BVHBound& other)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            if(other.data[i] < data[i])
+            {
+                data[i] = other.data[i];
+            }
+            if(other.data[i + 3] > data[i + 3])
+            {
+                data[i + 3] = other.data[i + 3];
+            }
+        }
+    }
+    
     bool IntersectRay(Ray const &r,
 //                      float& t,
                       float t_max = BIGFLOAT) const{
@@ -254,22 +277,583 @@ public:
     }
 };
 
+// 32 bytes, two nodes share a cache line. The first child of an internal node is
+// the next node in the array, the second one is at offset.
+struct alignas(32) LinearBVHNode
+{
+	float bound[6];
+	// leaf: index of the first primitive in LinearBVH::primitives, internal: index of the second child
+	unsigned int offset;
+	// packed so leaves gathered by Flatten can hold far more than 65535 primitives and still fit
+	unsigned int primitiveCount : 29;
+	// split axis, used to visit the child on the ray origin side first
+	unsigned int axis : 2;
+	unsigned int isLeaf : 1;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fill exactly half a cache line");
+
+// largest primitiveCount, a mesh would need more faces than fit in memory to fill such a leaf
+const unsigned int MaxLeafPrimitives = (1u << 29) - 1;
+
+// Leaves are at most this many levels below the root, which is what sizes the traversal stacks.
+// The binned builder switches to median splits to stay within it, Flatten and the bvh cache enforce it.
+const int MaxBVHDepth = 64;
+
+// Depth first node array built from a BVHNode tree, leaf primitives are stored contiguously.
+class LinearBVH
+{
+public:
+	void Flatten(BVHNode* root);
+
+	bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+	// Visits the leaves hit by the ray closer than tMax, near child first.
+	// intersectLeaf(node, tMax) returns true on a hit and shrinks tMax to the hit distance.
+	template <typename IntersectLeaf>
+	bool TraverseLeaves(SIMDRay const& ray, float& tMax, IntersectLeaf&& intersectLeaf) const
+	{
+		if (nodes.empty())
+		{
+			return false;
+		}
+
+		// one pushed sibling per internal node on the path
+		unsigned int stack[MaxBVHDepth];
+		int stackSize = 0;
+		unsigned int current = 0;
+		bool hit = false;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes[current];
+			float tNear;
+			if (IntersectBoundSIMD(node.bound, ray, tMax, tNear))
+			{
+				if (node.isLeaf)
+				{
+					if (intersectLeaf(node, tMax))
+					{
+						hit = true;
+					}
+
+					if (stackSize == 0)
+					{
+						break;
+					}
+					current = stack[--stackSize];
+				}
+				else
+				{
+					if (ray.dirIsNeg[node.axis])
+					{
+						stack[stackSize++] = current + 1;
+						current = node.offset;
+					}
+					else
+					{
+						stack[stackSize++] = node.offset;
+						current = current + 1;
+					}
+				}
+			}
+			else
+			{
+				if (stackSize == 0)
+				{
+					break;
+				}
+				current = stack[--stackSize];
+			}
+		}
+
+		return hit;
+	}
+
+	// Stops at the first leaf for which occludedLeaf(node) returns true, no ordering needed.
+	template <typename OccludedLeaf>
+	bool TraverseLeavesAny(SIMDRay const& ray, float tMax, OccludedLeaf&& occludedLeaf) const
+	{
+		if (nodes.empty())
+		{
+			return false;
+		}
+
+		// one pushed sibling per internal node on the path
+		unsigned int stack[MaxBVHDepth];
+		int stackSize = 0;
+		unsigned int current = 0;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes[current];
+			float tNear;
+			if (IntersectBoundSIMD(node.bound, ray, tMax, tNear))
+			{
+				if (node.isLeaf)
+				{
+					if (occludedLeaf(node))
+					{
+						return true;
+					}
+
+					if (stackSize == 0)
+					{
+						break;
+					}
+					current = stack[--stackSize];
+				}
+				else
+				{
+					stack[stackSize++] = node.offset;
+					current = current + 1;
+				}
+			}
+			else
+			{
+				if (stackSize == 0)
+				{
+					break;
+				}
+				current = stack[--stackSize];
+			}
+		}
+
+		return false;
+	}
+
+	// Per primitive versions of the above.
+	// intersectPrimitive(slot, tMax) returns true on a hit and shrinks tMax to the hit distance.
+	// slot indexes primitives and any per primitive data stored in the same leaf order.
+	template <typename IntersectPrimitive>
+	bool Traverse(Ray const& ray, float& tMax, IntersectPrimitive&& intersectPrimitive) const
+	{
+		return TraverseLeaves(SIMDRay(ray), tMax, [&](const LinearBVHNode& node, float& t)
+		{
+			bool hit = false;
+			for (unsigned int i = 0; i < node.primitiveCount; i++)
+			{
+				if (intersectPrimitive(node.offset + i, t))
+				{
+					hit = true;
+				}
+			}
+			return hit;
+		});
+	}
+
+	template <typename OccludedPrimitive>
+	bool TraverseAny(Ray const& ray, float tMax, OccludedPrimitive&& occludedPrimitive) const
+	{
+		return TraverseLeavesAny(SIMDRay(ray), tMax, [&](const LinearBVHNode& node)
+		{
+			for (unsigned int i = 0; i < node.primitiveCount; i++)
+			{
+				if (occludedPrimitive(node.offset + i))
+				{
+					return true;
+				}
+			}
+			return false;
+		});
+	}
+
+	std::vector<LinearBVHNode> nodes;
+	std::vector<unsigned int> primitives;
+
+private:
+	unsigned int FlattenNode(BVHNode* node, int depth);
+	void GatherFaces(BVHNode* node, std::vector<unsigned int>& faces);
+};
+
+void DeleteBVHTree(BVHNode* node);
+
+struct alignas(64) WideBVHNode
+{
+	// SoA child bounds, bounds[axis][lane] is the minimum and bounds[3 + axis][lane] the maximum.
+	// Empty lanes are inverted so they never pass the box test.
+	float bounds[6][4];
+	// internal child: index into WideBVH::nodes, leaf child: index of the leaf in the LinearBVH
+	unsigned int child[4];
+	unsigned char leafMask;
+	unsigned char childCount;
+	// front to back lane order per ray octant, two bits per lane.
+	// The octant has bit i set when the ray direction is negative on axis i.
+	unsigned char octantOrder[8];
+};
+
+static_assert(sizeof(WideBVHNode) == 128, "WideBVHNode should fill exactly two cache lines");
+
+// 4 wide BVH collapsed from a LinearBVH, one SIMD box test covers all children of a node.
+// Leaves stay in the LinearBVH, so primitives and leaf ordered data are shared with it.
+class WideBVH
+{
+public:
+	void Collapse(const LinearBVH& linear);
+
+	bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+	// Same contract as LinearBVH::TraverseLeaves, linear has to be the BVH this one was collapsed from.
+	template <typename IntersectLeaf>
+	bool TraverseLeaves(const LinearBVH& linear, SIMDRay const& ray, float& tMax, IntersectLeaf&& intersectLeaf) const
+	{
+		if (nodes.empty())
+		{
+			return false;
+		}
+
+		int octant = ray.dirIsNeg[0] | (ray.dirIsNeg[1] << 1) | (ray.dirIsNeg[2] << 2);
+
+		// entries are index << 1 | isLeaf
+		// an internal node pops itself and pushes up to four lanes, and sits at most MaxBVHDepth - 1 deep
+		unsigned int stack[3 * MaxBVHDepth + 1];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+		bool hit = false;
+
+		while (stackSize > 0)
+		{
+			unsigned int entry = stack[--stackSize];
+			if (entry & 1)
+			{
+				if (intersectLeaf(linear.nodes[entry >> 1], tMax))
+				{
+					hit = true;
+				}
+				continue;
+			}
+
+			const WideBVHNode& node = nodes[entry >> 1];
+			int mask = IntersectBounds4(node.bounds, ray, tMax);
+			if (mask == 0)
+			{
+				continue;
+			}
+
+			// push back to front so the nearest child is popped first
+			unsigned int order = node.octantOrder[octant];
+			for (int i = node.childCount - 1; i >= 0; i--)
+			{
+				int lane = (order >> (2 * i)) & 3;
+				if (mask & (1 << lane))
+				{
+					stack[stackSize++] = (node.child[lane] << 1) | ((node.leafMask >> lane) & 1);
+				}
+			}
+		}
+
+		return hit;
+	}
+
+	template <typename OccludedLeaf>
+	bool TraverseLeavesAny(const LinearBVH& linear, SIMDRay const& ray, float tMax, OccludedLeaf&& occludedLeaf) const
+	{
+		if (nodes.empty())
+		{
+			return false;
+		}
+
+		// an internal node pops itself and pushes up to four lanes, and sits at most MaxBVHDepth - 1 deep
+		unsigned int stack[3 * MaxBVHDepth + 1];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			unsigned int entry = stack[--stackSize];
+			if (entry & 1)
+			{
+				if (occludedLeaf(linear.nodes[entry >> 1]))
+				{
+					return true;
+				}
+				continue;
+			}
+
+			const WideBVHNode& node = nodes[entry >> 1];
+			int mask = IntersectBounds4(node.bounds, ray, tMax);
+			for (int lane = 0; lane < node.childCount; lane++)
+			{
+				if (mask & (1 << lane))
+				{
+					stack[stackSize++] = (node.child[lane] << 1) | ((node.leafMask >> lane) & 1);
+				}
+			}
+		}
+
+		return false;
+	}
+
+	std::vector<WideBVHNode> nodes;
+
+private:
+	unsigned int CollapseNode(const LinearBVH& linear, unsigned int linearIndex);
+};
+
+// Triangles of a mesh BVH in leaf order. The scalar records serve the ray differentials,
+// the 4 wide packets (every leaf starts a new one) feed the SIMD kernels.
+struct LeafTriangles
+{
+	std::vector<PrecomputedTriangle> triangles;
+	std::vector<TrianglePacket4> packets;
+	// first packet of each leaf, indexed by node
+	std::vector<unsigned int> leafPackets;
+
+	void BuildPackets(const LinearBVH& linear)
+	{
+		packets.clear();
+		leafPackets.assign(linear.nodes.size(), 0);
+
+		for (size_t nodeIndex = 0; nodeIndex < linear.nodes.size(); nodeIndex++)
+		{
+			const LinearBVHNode& node = linear.nodes[nodeIndex];
+			if (!node.isLeaf)
+			{
+				continue;
+			}
+
+			leafPackets[nodeIndex] = (unsigned int)packets.size();
+			for (unsigned int i = 0; i < node.primitiveCount; i += 4)
+			{
+				TrianglePacket4 packet = {};
+				for (unsigned int lane = 0; lane < 4 && i + lane < node.primitiveCount; lane++)
+				{
+					const PrecomputedTriangle& triangle = triangles[node.offset + i + lane];
+					for (int axis = 0; axis < 3; axis++)
+					{
+						packet.v0[axis][lane] = triangle.v0[axis];
+						packet.e1[axis][lane] = triangle.e1[axis];
+						packet.e2[axis][lane] = triangle.e2[axis];
+					}
+				}
+				packets.push_back(packet);
+			}
+		}
+	}
+
+	unsigned int GetPacketCount(const LinearBVHNode& node) const
+	{
+		return (node.primitiveCount + 3) / 4;
+	}
+
+	const TrianglePacket4* GetPackets(const LinearBVH& linear, const LinearBVHNode& node) const
+	{
+		return packets.data() + leafPackets[&node - linear.nodes.data()];
+	}
+};
+
+// Closest triangle hit closer than tMax. Only the distance and barycentrics are computed,
+// the caller interpolates the surface attributes of the winner. The wide BVH is used when it was built.
+inline bool FindClosestTriangle(const LinearBVH& linear, const WideBVH& wide, const LeafTriangles& leafTriangles, Ray const& ray, int hitSide, float tMax, TriangleHit& closest)
+{
+	SIMDRay simdRay(ray);
+	auto intersectLeaf = [&](const LinearBVHNode& node, float& t)
+	{
+		PacketHit hit;
+		if (IntersectTrianglePackets(leafTriangles.GetPackets(linear, node), leafTriangles.GetPacketCount(node), simdRay, hitSide, 0.0f, t, hit))
+		{
+			t = hit.t;
+			closest.slot = node.offset + hit.lane;
+			closest.faceId = linear.primitives[closest.slot];
+			closest.t = hit.t;
+			closest.u = hit.u;
+			closest.v = hit.v;
+			closest.front = hit.front;
+			return true;
+		}
+		return false;
+	};
+
+	if (!wide.IsEmpty())
+	{
+		return wide.TraverseLeaves(linear, simdRay, tMax, intersectLeaf);
+	}
+	return linear.TraverseLeaves(simdRay, tMax, intersectLeaf);
+}
+
+inline bool AnyTriangle(const LinearBVH& linear, const WideBVH& wide, const LeafTriangles& leafTriangles, Ray const& ray, int hitSide, float tMin, float tMax)
+{
+	SIMDRay simdRay(ray);
+	auto occludedLeaf = [&](const LinearBVHNode& node)
+	{
+		return OccludedTrianglePackets(leafTriangles.GetPackets(linear, node), leafTriangles.GetPacketCount(node), simdRay, hitSide, tMin, tMax);
+	};
+
+	if (!wide.IsEmpty())
+	{
+		return wide.TraverseLeavesAny(linear, simdRay, tMax, occludedLeaf);
+	}
+	return linear.TraverseLeavesAny(simdRay, tMax, occludedLeaf);
+}
+
+enum class BVHBuildMethod
+{
+	// sweeps 50 split planes per axis, re-partitioning the whole face list each time
+	ScanLine,
+	// buckets precomputed centroids into a fixed number of bins per axis
+	BinnedSAH
+};
+
+enum class BVHLayout
+{
+	// LinearBVH, one box test per node
+	Binary,
+	// LinearBVH collapsed into a WideBVH, four children tested at once
+	Wide4
+};
+
+struct BVHBuildSettings
+{
+	BVHBuildMethod method = BVHBuildMethod::BinnedSAH;
+	BVHLayout layout = BVHLayout::Binary;
+	int binCount = 16;
+	// nodes bigger than this are always split, even if SAH prefers a leaf
+	int maxLeafSize = 4;
+	// read and write mesh BVHs under bvhcache/, see bvhcache.h
+	bool useCache = true;
+	// binned SAH subtrees with at least this many primitives are built on their own thread
+	unsigned int parallelSplitSize = 16384;
+};
+
+// set per scene by the <bvh> element, see xmlload.cpp
+extern BVHBuildSettings bvhBuildSettings;
+
+// Builds a BVHNode tree from per primitive bounds. Centroids and bounds are computed once,
+// every node works on a range of a single index array which is partitioned in place.
+class BinnedSAHBuilder
+{
+public:
+	BinnedSAHBuilder(const BVHBuildSettings& _settings)
+		:settings(_settings)
+	{
+	}
+
+	BVHNode* Build(const std::vector<BVHBound>& primitiveBounds);
+
+private:
+	struct Bin
+	{
+		BVHBound bound;
+		unsigned int count = 0;
+	};
+
+	// past this depth nodes are split at the centroid median instead of by SAH, see MaxBVHDepth
+	static const int MedianSplitDepth = 48;
+
+	// forkDepth counts the subtree forks left on this path, the threads only ever touch their own index range
+	void BuildNode(BVHNode* node, unsigned int begin, unsigned int end, int depth, int forkDepth);
+	void BuildChildren(BVHNode* node, unsigned int begin, unsigned int middle, unsigned int end, int depth, int forkDepth);
+	void MakeLeaf(BVHNode* node, unsigned int begin, unsigned int end);
+
+	BVHBuildSettings settings;
+	std::vector<BVHBound> bounds;
+	std::vector<Vec3f> centroids;
+	std::vector<unsigned int> indices;
+};
+
 class MeshBVHNew
 {
 public:
-	MeshBVHNew(Mesh* triObj)
+	MeshBVHNew(Mesh* triObj, const BVHBuildSettings& settings = bvhBuildSettings)
 	{
 		mesh = triObj;
-		BuildRoot();
+
+		auto start = std::chrono::steady_clock::now();
+		if (settings.method == BVHBuildMethod::BinnedSAH)
+		{
+			std::vector<BVHBound> faceBounds(mesh->faces.size());
+			for (size_t i = 0; i < mesh->faces.size(); i++)
+			{
+				for (int index = 0; index < 3; index++)
+				{
+					const glm::vec3& vertex = mesh->vertices[mesh->faces[i].indices[index]];
+					faceBounds[i].UpdateByPoint(Vec3f(vertex.x, vertex.y, vertex.z));
+				}
+			}
+			root = BinnedSAHBuilder(settings).Build(faceBounds);
+		}
+		else
+		{
+			BuildRoot();
+		}
+
+		linear.Flatten(root);
+		DeleteBVHTree(root);
+		root = nullptr;
+
+		if (settings.layout == BVHLayout::Wide4)
+		{
+			wide.Collapse(linear);
+		}
+
+		BuildLeafTriangles();
+
+		buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// adopts node arrays read back from the bvh cache, only the leaf triangles are rebuilt
+	MeshBVHNew(Mesh* triObj, LinearBVH&& _linear, WideBVH&& _wide)
+		:mesh(triObj), root(nullptr), linear(std::move(_linear)), wide(std::move(_wide))
+	{
+		auto start = std::chrono::steady_clock::now();
+		BuildLeafTriangles();
+		buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const LinearBVH& GetLinearBVH() const
+	{
+		return linear;
+	}
+
+	const WideBVH& GetWideBVH() const
+	{
+		return wide;
+	}
+
+	// in leaf order, indexed by the traversal slot
+	const std::vector<PrecomputedTriangle>& GetTriangles() const
+	{
+		return leafTriangles.triangles;
+	}
+
+	bool Intersect(Ray const& ray, int hitSide, float tMax, TriangleHit& closest) const
+	{
+		return FindClosestTriangle(linear, wide, leafTriangles, ray, hitSide, tMax, closest);
+	}
+
+	bool Occluded(Ray const& ray, int hitSide, float tMin, float tMax) const
+	{
+		return AnyTriangle(linear, wide, leafTriangles, ray, hitSide, tMin, tMax);
 	}
 
-	BVHNode* GetRoot()
+	float GetBuildTime() const
 	{
-		return root;
+		return buildSeconds;
 	}
 
 private:
 
+	void BuildLeafTriangles()
+	{
+		std::vector<PrecomputedTriangle>& triangles = leafTriangles.triangles;
+		triangles.resize(linear.primitives.size());
+		for (size_t i = 0; i < linear.primitives.size(); i++)
+		{
+			const Face& face = mesh->faces[linear.primitives[i]];
+			const glm::vec3& v0 = mesh->vertices[face.indices[0]];
+			const glm::vec3& v1 = mesh->vertices[face.indices[1]];
+			const glm::vec3& v2 = mesh->vertices[face.indices[2]];
+			triangles[i].Set(Vec3f(v0.x, v0.y, v0.z), Vec3f(v1.x, v1.y, v1.z), Vec3f(v2.x, v2.y, v2.z));
+		}
+		leafTriangles.BuildPackets(linear);
+	}
+
 	void BuildRoot()
 	{
 		// divide by middle
@@ -526,6 +1110,10 @@ private:
 
 	Mesh* mesh;
 	BVHNode* root;
+	LinearBVH linear;
+	WideBVH wide;
+	LeafTriangles leafTriangles;
+	float buildSeconds = 0.0f;
 
 };
 
@@ -547,15 +1135,65 @@ private:
 class MeshBVH
 {
 public:
-    MeshBVH(TriObj* triObj)
+    MeshBVH(TriObj* triObj, const BVHBuildSettings& settings = bvhBuildSettings)
     {
         mesh = triObj;
-        BuildRoot();
+        
+        if(settings.method == BVHBuildMethod::BinnedSAH)
+        {
+            std::vector<BVHBound> faceBounds(mesh->NF());
+            for(unsigned int i = 0; i < mesh->NF(); i++)
+            {
+                for(int index = 0; index < 3; index++)
+                {
+                    faceBounds[i].UpdateByPoint(mesh->V(mesh->F(i).v[index]));
+                }
+            }
+            root = BinnedSAHBuilder(settings).Build(faceBounds);
+        }
+        else
+        {
+            BuildRoot();
+        }
+        
+        linear.Flatten(root);
+        DeleteBVHTree(root);
+        root = nullptr;
+        
+        std::vector<PrecomputedTriangle>& triangles = leafTriangles.triangles;
+        triangles.resize(linear.primitives.size());
+        for(size_t i = 0; i < linear.primitives.size(); i++)
+        {
+            const auto& face = mesh->F(linear.primitives[i]);
+            triangles[i].Set(mesh->V(face.v[0]), mesh->V(face.v[1]), mesh->V(face.v[2]));
+        }
+        leafTriangles.BuildPackets(linear);
+        
+        if(settings.layout == BVHLayout::Wide4)
+        {
+            wide.Collapse(linear);
+        }
+    }
+    
+    const LinearBVH& GetLinearBVH() const
+    {
+        return linear;
+    }
+    
+    // in leaf order, indexed by the traversal slot
+    const std::vector<PrecomputedTriangle>& GetTriangles() const
+    {
+        return leafTriangles.triangles;
+    }
+    
+    bool Intersect(Ray const& ray, int hitSide, float tMax, TriangleHit& closest) const
+    {
+        return FindClosestTriangle(linear, wide, leafTriangles, ray, hitSide, tMax, closest);
     }
     
-    BVHNode* GetRoot()
+    bool Occluded(Ray const& ray, int hitSide, float tMin, float tMax) const
     {
-        return root;
+        return AnyTriangle(linear, wide, leafTriangles, ray, hitSide, tMin, tMax);
     }
     
 private:
@@ -812,6 +1450,9 @@ private:
     
     TriObj* mesh;
     BVHNode* root;
+    LinearBVH linear;
+    WideBVH wide;
+    LeafTriangles leafTriangles;
     
 };
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "bvh.h"
+#include <stdint.h>
+#include <string>
+
+class Mesh;
+
+// Mesh BVHs persisted across runs, one file per mesh under bvhcache/<hash>.bvh.
+// The hash covers the triangles and every build setting, so an edited asset or a different
+// builder simply misses. The file is a fixed header followed by the raw node and primitive
+// arrays at 64 byte aligned offsets, laid out so it could be mapped as is.
+namespace BVHCache
+{
+	const uint32_t Version = 2;
+
+	// FNV-1a 64 over vertex positions, face indices and build settings
+	uint64_t HashMesh(const Mesh& mesh, const BVHBuildSettings& settings);
+
+	std::string GetPath(uint64_t hash);
+
+	// nullptr if there is no valid entry for hash
+	MeshBVHNew* Load(uint64_t hash, Mesh* mesh);
+
+	// written to a temporary file first, so readers never see half an entry
+	bool Save(uint64_t hash, const MeshBVHNew& bvh);
+}
@@ -13,4 +13,5 @@ constexpr float EPSILON = FLT_EPSILON;
 #define HIT_FRONT           1
 #define HIT_BACK            2
 #define HIT_FRONT_AND_BACK  (HIT_FRONT|HIT_BACK)
-#define INTERSECTION_BIAS 0.0001f
\ No newline at end of file
+#define INTERSECTION_BIAS 0.0001f
+#define SHADOW_EPSILON 0.0001f
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include "scene.h"
+
+class Film;
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided luminance
+// weight of SVGF. Every iteration is a 5x5 B3 spline kernel with taps spread 2^i pixels apart,
+// weighted down across normal, depth and luminance edges. The luminance weight is scaled by the
+// pixel's estimated noise, so converged pixels are left alone. Lighting is filtered with the albedo
+// divided out and multiplied back afterwards, so textures stay sharp.
+class ATrousDenoiser
+{
+public:
+	int iterations = 5;
+	// edge stopping, larger is more permissive
+	float colorSigma = 4.0f;
+	float normalPower = 128.0f;
+	float depthSigma = 0.05f;
+	// 0 uses every hardware thread
+	unsigned int threadCount = 0;
+
+	// Filters the film's beauty into output, width * height linear colors. Needs the albedo, normal
+	// and depth layers, returns false without them.
+	bool Denoise(const Film& film, std::vector<Color>& output) const;
+};
@@ -5,11 +5,6 @@
 #include "utils.h"
 #include "constants.h"
 
-float RandomFrom0To1()
-{
-	return (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
-}
-
 float sqr(float f) 
 {
 	return f * f;
@@ -214,10 +209,11 @@ public:
 		return f * NdotL;
 	}
 
-	Vec3f DisneySample(DisneyShadingInfo& shading, const Vec3f& V, const Vec3f& N) 
+	// u picks the lobe and the direction within it
+	Vec3f DisneySample(DisneyShadingInfo& shading, const Vec3f& V, const Vec3f& N, Vec2f u) 
 	{
-		float r1 = RandomFrom0To1();
-		float r2 = RandomFrom0To1();
+		float r1 = u.x;
+		float r2 = u.y;
 
 		const Vec3f U = abs(N.z) < (1.0f - EPSILON) ? Vec3f(0.0f, 0.0f, 1.0f) : Vec3f(1.0f, 0.0f, 0.0f);
 		const Vec3f T = U.Cross(N).GetNormalized();
@@ -92,7 +92,7 @@ public:
 		return brdf.DisneyPdf(shading, NDotH, NDotL, HDotL);
 	}
 
-	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability)
+	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability, SamplerContext& sampler)
 	{
 		DisneyShadingInfo shading;
 
@@ -120,7 +120,7 @@ public:
 			brdfN.Normalize();
 		}
 
-		wi = brdf.DisneySample(shading, wo, brdfN);
+		wi = brdf.DisneySample(shading, wo, brdfN, sampler.Next2D());
 
 		probability = InternalComputePdf(shading, wi, wo, brdfN);
 	}
@@ -202,6 +202,11 @@ public:
 		return emission + brdf.DisneyEval(shading, NDotL, NDotV, NDotH, HDotL);
 	}
 
+	virtual Color GetAlbedo(const HitInfo& hInfo)
+	{
+		return albedo.SampleSrgb(hInfo.uvw, hInfo.duvw);
+	}
+
 private:
 
 	BrdfDisney brdf;
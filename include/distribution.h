@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include "cyVector.h"
+
+using namespace cy;
+
+// Discrete distribution over weighted items, built once at load time.
+// Sample is O(1) through a Walker/Vose alias table, SampleInverse is a binary search over the CDF
+// for callers that need the mapping from u to index to be monotonic, e.g. to keep stratification.
+// Weights of zero are never returned. When every weight is zero the items are sampled uniformly.
+class Distribution1D
+{
+public:
+	Distribution1D() {}
+	explicit Distribution1D(const std::vector<float>& weights)
+	{
+		Build(weights);
+	}
+
+	void Build(const std::vector<float>& weights);
+	void Clear();
+
+	// u in [0, 1), pdf is the discrete probability of the returned index
+	int Sample(float u, float* pdf = nullptr) const;
+	// also returns u remapped to [0, 1) inside the chosen item, when remapped is not null
+	int SampleInverse(float u, float* pdf = nullptr, float* remapped = nullptr) const;
+	// samples as if excluded had no weight, the others keep their relative probabilities.
+	// -1 when nothing else has any weight.
+	int SampleExcluding(float u, int excluded, float* pdf = nullptr) const;
+
+	// probability of picking index
+	float Pdf(int index) const
+	{
+		return probabilities[index];
+	}
+
+	unsigned int Count() const { return (unsigned int)probabilities.size(); }
+	bool Empty() const { return probabilities.empty(); }
+	// sum of the weights given to Build
+	float Total() const { return total; }
+
+private:
+	struct AliasBin
+	{
+		// chance of keeping the bin's own index rather than its alias
+		float threshold;
+		int alias;
+	};
+
+	float total = 0.0f;
+	std::vector<float> probabilities;
+	// cdf[i] is the probability of the indices below i, cdf.back() is 1
+	std::vector<float> cdf;
+	std::vector<AliasBin> bins;
+};
+
+// Piecewise constant density over [0, 1)^2 from a grid of weights, stored row by row. A row is picked
+// from the marginal distribution of the row sums, then a column from that row's distribution.
+class Distribution2D
+{
+public:
+	void Build(const std::vector<float>& weights, unsigned int _width, unsigned int _height);
+	void Clear();
+
+	// a continuous point, pdf with respect to area on [0, 1)^2
+	Vec2f Sample(Vec2f u, float& pdf) const;
+	float Pdf(Vec2f p) const;
+
+	bool Empty() const { return marginal.Empty() || marginal.Total() <= 0.0f; }
+
+private:
+	unsigned int width = 0;
+	unsigned int height = 0;
+	Distribution1D marginal;
+	std::vector<Distribution1D> conditionals;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "distribution.h"
+
+class TexturedColor;
+
+// The environment as a light for next event estimation. Directions are drawn from a piecewise
+// constant table over the lat-long map, each cell weighted by its luminance and the solid angle it
+// covers, so small bright regions like the sun are found without waiting for a brdf sample to hit them.
+class EnvironmentLight
+{
+public:
+	// Tabulates the environment at the resolution of its texture, at most maxWidth wide, or coarsely
+	// when it is a plain color. Stays empty when the environment is black.
+	void Build(const TexturedColor& environment, unsigned int maxWidth = 2048);
+	void Clear() { distribution.Clear(); }
+	bool Empty() const { return distribution.Empty(); }
+
+	// a direction towards the environment and its pdf per unit solid angle
+	Vec3f Sample(Vec2f u, float& pdf) const;
+	float Pdf(const Vec3f& dir) const;
+
+	// the lat-long mapping of TexturedColor::SampleEnvironment and its inverse
+	static Vec2f DirectionToUV(const Vec3f& dir);
+	static Vec3f UVToDirection(Vec2f uv);
+
+private:
+	Distribution2D distribution;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "scene.h"
+
+// Result of one path, filled in by RenderPixel. Everything is linear.
+struct PixelContext
+{
+	Color color = Color::Black();
+	// first hit, left at zero when the camera ray misses
+	Color albedo = Color::Black();
+	Vec3f normal = Vec3f(0.0f, 0.0f, 0.0f);
+	Vec3f position = Vec3f(0.0f, 0.0f, 0.0f);
+	float z = BIGFLOAT;
+	// share of color per light, only sized when a light layer is registered
+	std::vector<Color> lights;
+
+	void Reset()
+	{
+		color = Color::Black();
+		albedo = Color::Black();
+		normal = Vec3f(0.0f, 0.0f, 0.0f);
+		position = Vec3f(0.0f, 0.0f, 0.0f);
+		z = BIGFLOAT;
+		for (Color& light : lights)
+		{
+			light = Color::Black();
+		}
+	}
+};
+
+enum class AOVType
+{
+	Albedo,
+	Normal,
+	Position,
+	// closest hit distance over all samples, not averaged
+	Depth,
+	// variance of the pixel's mean luminance, derived from the beauty
+	Variance,
+	SampleCount,
+	// emitted and direct light of one light, summed over all bounces
+	Light
+};
+
+// Linear radiance accumulated per pixel, shared by all render workers. Within a pass the tile
+// scheduler gives every pixel to exactly one worker, so AddSample needs no synchronisation.
+// Tone mapping and gamma only happen in Resolve, when a frame is actually looked at.
+// Auxiliary layers are registered once before rendering and exported with the beauty.
+class Film
+{
+public:
+	struct Pixel
+	{
+		Color sum = Color::Black();
+		float weight = 0.0f;
+		unsigned int sampleCount = 0;
+		float luminanceSquaredSum = 0.0f;
+	};
+
+	struct Layer
+	{
+		AOVType type;
+		unsigned int lightIndex = 0;
+		unsigned int channelCount = 0;
+		// weighted sums, channelCount floats per pixel, empty for derived layers
+		std::vector<float> values;
+	};
+
+	// also drops the layers, they are registered again for every render
+	void Init(unsigned int _width, unsigned int _height);
+	// drops the samples, keeps the layers
+	void Clear();
+
+	// registers a layer, a second registration of the same one is ignored
+	void AddLayer(AOVType type, unsigned int lightIndex = 0);
+	bool HasLayer(AOVType type) const;
+	const std::vector<Layer>& GetLayers() const { return layers; }
+
+	// sizes sample.lights for the registered light layers
+	void PrepareSample(PixelContext& sample) const;
+
+	void AddSample(unsigned int x, unsigned int y, const PixelContext& sample, float weight = 1.0f);
+
+	unsigned int GetSampleCount(unsigned int x, unsigned int y) const
+	{
+		return pixels[x + y * width].sampleCount;
+	}
+
+	// linear radiance, the weighted mean of the samples so far
+	Color GetColor(unsigned int x, unsigned int y) const
+	{
+		const Pixel& pixel = pixels[x + y * width];
+		return pixel.weight > 0.0f ? pixel.sum / pixel.weight : Color::Black();
+	}
+
+	// variance of the mean luminance, 0 below two samples
+	float GetVariance(unsigned int x, unsigned int y) const;
+
+	// standard error of the mean luminance relative to the mean. The mean is floored at 1% of white,
+	// near black pixels would otherwise never converge.
+	float GetRelativeError(unsigned int x, unsigned int y) const;
+
+	// ACES tone mapping and gamma into the 8 bit image. May run while workers are still adding
+	// samples, a pixel read in the middle of an update only shows up in that preview frame.
+	void Resolve(RenderImage& image) const;
+
+	// false colour preview of a layer for the viewer, output holds width * height pixels
+	void ResolveLayer(AOVType type, Color24* output) const;
+
+	// ACES and gamma of one linear color, what Resolve does per pixel
+	static Color24 ToDisplay(const Color& color);
+
+	// the channels of a registered layer at one pixel, means for accumulated layers.
+	// false if the layer is not registered, derived layers are always available.
+	bool GetLayerPixel(AOVType type, unsigned int x, unsigned int y, float* values) const;
+
+	// one row of linear RGB, width * 3 floats, for the HDR writers
+	void GetScanline(unsigned int y, float* rgb) const;
+
+	// R, G, B followed by the channels of every layer, in the order GetChannels fills them
+	std::vector<std::string> GetChannelNames() const;
+	void GetChannels(unsigned int y, float* values) const;
+
+	unsigned int GetWidth() const { return width; }
+	unsigned int GetHeight() const { return height; }
+
+	// What else a render needs to continue where it stopped. The samplers have no state of their own,
+	// a pixel's next sample follows from its sample count, the seed and the sampler type.
+	struct CheckpointInfo
+	{
+		uint32_t passCount = 0;
+		uint32_t samplerType = 0;
+		uint64_t seed = 0;
+		// scene file and camera the film was rendered from, see RenderSettings::sceneHash
+		uint64_t sceneHash = 0;
+	};
+
+	// Raw sums, counts and layers, written to a temporary file and renamed, so a crash while
+	// writing leaves the previous checkpoint intact.
+	bool SaveCheckpoint(const std::string& path, const CheckpointInfo& info) const;
+	// Fails, leaving the film untouched, unless the file matches the film's size and layers
+	// and was rendered from info.sceneHash. The rest of info is filled in from the file.
+	bool LoadCheckpoint(const std::string& path, CheckpointInfo& info);
+
+private:
+	const Layer* FindLayer(AOVType type) const;
+	// the layer's channels at one pixel, means for accumulated layers
+	void GetLayerValue(const Layer& layer, unsigned int x, unsigned int y, float* values) const;
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int lightLayerCount = 0;
+	std::vector<Pixel> pixels;
+	std::vector<Layer> layers;
+};
@@ -16,7 +16,7 @@ public:
     
     ~Filter()
     {
-        delete outputColors;
+        delete[] outputColors;
     }
     
     virtual void Compute() = 0;
@@ -141,6 +141,7 @@ private:
 };
 
 #define GAUSSIAN_MAX_RADIUS 10
+#define GAUSSIAN_KERNEL_SIZE (2 * GAUSSIAN_MAX_RADIUS + 1)
 class GaussianFilter : public Filter{
 public:
     GaussianFilter(Color24* input, unsigned int _width, unsigned int _height, float _alpha, Vec2f _radius)
@@ -148,24 +149,23 @@ public:
     alpha(_alpha),
     radius(_radius)
     {
-        assert(GAUSSIAN_MAX_RADIUS % 2 == 0);
-        
         assert(radius.x < GAUSSIAN_MAX_RADIUS);
         assert(radius.y < GAUSSIAN_MAX_RADIUS);
         
         constantComponentX = -1.0f * std::exp(-alpha * radius.x * radius.x);
         constantComponentY = -1.0f * std::exp(-alpha * radius.y * radius.y);
-        factorArray = new float[(GAUSSIAN_MAX_RADIUS + 1) * (GAUSSIAN_MAX_RADIUS + 1)];
+        factorArray = new float[GAUSSIAN_KERNEL_SIZE * GAUSSIAN_KERNEL_SIZE];
     }
     
     ~GaussianFilter()
     {
-        delete factorArray;
+        delete[] factorArray;
     }
     
     virtual void Compute()
     {
-        int center = GAUSSIAN_MAX_RADIUS / 2;
+        // offsets reach from -GAUSSIAN_MAX_RADIUS to GAUSSIAN_MAX_RADIUS
+        int center = GAUSSIAN_MAX_RADIUS;
         
         int left = floor(-radius.x);
         int right = ceil(radius.x);
@@ -178,8 +178,8 @@ public:
         {
             for(int offsetY = top; offsetY <= bottom; offsetY++)
             {
-                factorArray[(center + offsetX) + (center + offsetY) * width] = Gaussian(offsetX, constantComponentX) *  Gaussian(offsetY, constantComponentY);
-                factorSum += factorArray[(center + offsetX) + (center + offsetY) * width];
+                factorArray[(center + offsetX) + (center + offsetY) * GAUSSIAN_KERNEL_SIZE] = Gaussian(offsetX, constantComponentX) *  Gaussian(offsetY, constantComponentY);
+                factorSum += factorArray[(center + offsetX) + (center + offsetY) * GAUSSIAN_KERNEL_SIZE];
             }
         }
         
@@ -195,8 +195,8 @@ public:
             {
                 for(int offsetY = top; offsetY <= bottom; offsetY++)
                 {
-                    float factor = factorArray[(center + offsetX) + (center + offsetY) * width];
-                    pixelResult += factor * (GetInputPixel(x + offsetX, y +offsetY).ToColor());
+                    float factor = factorArray[(center + offsetX) + (center + offsetY) * GAUSSIAN_KERNEL_SIZE];
+                    pixelResult += factor * (GetInputPixel(ClampToZero(x + offsetX), ClampToZero(y + offsetY)).ToColor());
                 }
             }
             
@@ -206,6 +206,12 @@ public:
     
 private:
     
+    // GetInputPixel takes unsigned coordinates, a negative one would wrap to the far edge
+    static unsigned int ClampToZero(int v)
+    {
+        return v < 0 ? 0 : (unsigned int)v;
+    }
+    
     float Gaussian(float x, float contantComponent)
     {
         float result = std::exp(-alpha * x * x) + contantComponent;
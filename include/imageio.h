@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Linear HDR image writers. The pixels are pulled one scanline at a time through a callback,
+// so an image is written straight from the accumulation buffer without a full size copy.
+namespace ImageIO
+{
+	enum class PixelType
+	{
+		Half,
+		Float
+	};
+
+	// fills values with one row of width * channelCount interleaved floats, y = 0 is the top row
+	using ScanlineFunc = std::function<void(unsigned int y, float* values)>;
+
+	uint16_t FloatToHalf(float value);
+
+	// "pfm", "exr" or "png", lower case, from the file name
+	std::string GetFormat(const std::string& path);
+
+	// portable float map, three channels
+	bool WritePFM(const std::string& path, unsigned int width, unsigned int height, const ScanlineFunc& scanline);
+
+	// Uncompressed scanline OpenEXR, any number of channels, named in the order the callback fills them.
+	// Readers expect the common names R, G, B, A and "layer.R" style names for extra layers.
+	bool WriteEXR(const std::string& path, unsigned int width, unsigned int height,
+		const std::vector<std::string>& channels, PixelType type, const ScanlineFunc& scanline);
+}
@@ -4,6 +4,7 @@
 #include "hitinfo.h"
 #include "raytracer.h"
 #include "objects.h"
+#include "lightsampler.h"
 
 class LightComponent 
 {
@@ -11,10 +12,17 @@ public:
 	cy::Color Le() const;
 	cy::Color ComputeLe(const Vec3f& lightPos, const Vec3f& lightNormal, const Vec3f& objPos, const Vec3f& wi) const;
 
-	float Pdf(const HitInfo& hitInfo, const Interaction& sampleInteraction, float distance);
+	// per unit solid angle, 0 if wi misses the light or is blocked
 	float Pdf(const HitInfo& hitInfo, const Vec3f& wi);
-	cy::Color SampleLi(const HitInfo& hitInfo, float& pdf, Vec3f& wi);
+	cy::Color SampleLi(const HitInfo& hitInfo, float& pdf, Vec3f& wi, SamplerContext& sampler);
+
+	// emitted power up to a constant factor, average intensity times world space area
+	float Power() const;
+	// world space bounds, power and emission directions for the light BVH
+	LightBounds Bounds() const;
 
 	Node* parent = nullptr;
 	cy::Color intensity = cy::Color::Black();
+	// position in lightList
+	unsigned int index = 0;
 };
\ No newline at end of file
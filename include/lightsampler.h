@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include "cyVector.h"
+#include "box.h"
+#include "distribution.h"
+
+using namespace cy;
+
+class LightComponent;
+
+enum class LightSamplerType
+{
+	// by emitted power alone, the same for every shading point
+	Power,
+	// by a conservative estimate of the light reaching the shading point, through the light BVH
+	BVH
+};
+
+// What the light BVH knows about a light or a group of lights: where they are, how much they emit and
+// in which directions. Following Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+// Adaptive Tree Splitting" (2018), with the importance of pbrt-v4.
+struct LightBounds
+{
+	Box bounds;
+	float phi = 0.0f;
+	// the normals lie within acos(cosThetaO) of w, -1 for any direction
+	Vec3f w = Vec3f(0.0f, 0.0f, 1.0f);
+	float cosThetaO = -1.0f;
+	// and each normal emits within acos(cosThetaE) of itself, 0 for one sided area lights
+	float cosThetaE = 0.0f;
+
+	// upper bound of the light reaching a point p with normal n, up to a constant factor.
+	// 0 only if no light of the group can reach p.
+	float Importance(const Vec3f& p, const Vec3f& n) const;
+
+	static LightBounds Union(const LightBounds& a, const LightBounds& b);
+};
+
+// Binary tree over the lights, built once after the scene is loaded. Sampling walks down from the root
+// choosing each child in proportion to its importance, so the cost is logarithmic in the light count
+// and lights that can't reach the shading point are never picked.
+class LightBVH
+{
+public:
+	void Build(const std::vector<LightComponent*>& lights);
+	void Clear() { nodes.clear(); }
+	bool Empty() const { return nodes.empty(); }
+
+	// index of the picked light in the list given to Build, -1 if none reaches p.
+	// excluded is never picked, pmf is the probability of the returned light.
+	int Sample(const Vec3f& p, const Vec3f& n, float u, int excluded, float& pmf) const;
+
+private:
+	struct BVHNode
+	{
+		LightBounds bounds;
+		// the first child follows its parent, lightIndex is only used by leaves
+		int secondChild = -1;
+		int lightIndex = -1;
+	};
+
+	struct BuildLight
+	{
+		int index;
+		LightBounds bounds;
+	};
+
+	int BuildRecursive(std::vector<BuildLight>& lights, int begin, int end);
+	float ChildImportance(int nodeIndex, const Vec3f& p, const Vec3f& n, int excluded) const;
+
+	std::vector<BVHNode> nodes;
+};
+
+// Picks the light for next event estimation, indexes are into lightList
+class LightSampler
+{
+public:
+	void Build(const std::vector<LightComponent*>& lights, LightSamplerType _type);
+
+	// -1 if no light can be picked, excluded never is. pmf is the probability of the returned light.
+	int Sample(const Vec3f& p, const Vec3f& n, float u, int excluded, float& pmf) const;
+
+private:
+	LightSamplerType type = LightSamplerType::BVH;
+	Distribution1D powerDistribution;
+	LightBVH bvh;
+};
@@ -5,12 +5,13 @@
 #include "cyColor.h"
 
 #include "scene.h"
+#include "rng.h"
 
 class Material : public ItemBase
 {
 public:
 
-	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability)
+	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability, SamplerContext&)
 	{
 
 	}
@@ -24,4 +25,10 @@ public:
 	{
 		return Color::Black();
 	}
+
+	// base color at the hit, linear, for the albedo AOV
+	virtual Color GetAlbedo(const HitInfo&)
+	{
+		return Color::Black();
+	}
 };
\ No newline at end of file
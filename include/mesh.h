@@ -16,7 +16,9 @@
 #include <spdlog/spdlog.h>
 
 #include "utils.h"
+#include "distribution.h"
 #include "hitinfo.h"
+#include "rng.h"
 
 class MeshBVHNew;
 
@@ -33,12 +35,11 @@ public:
 	Mesh() 
 	{
 		area = 0.0f;
-		cdf.Init();
 	} 
 
-	Interaction SampleFace(int faceId)
+	Interaction SampleFace(int faceId, Vec2f u)
 	{
-		Vec2f b = UniformSampleTriangle();
+		Vec2f b = UniformSampleTriangle(u);
 
 		auto face = faces[faceId];
 		auto p0 = vertices[face.indices[0]];
@@ -54,10 +55,10 @@ public:
 		return it;
 	}
 
-	Interaction Sample()
+	Interaction Sample(SamplerContext& sampler)
 	{
-		int faceId = cdf.Sample();
-		return SampleFace(faceId);
+		int faceId = faceDistribution.Sample(sampler.Next1D());
+		return SampleFace(faceId, sampler.Next2D());
 	}
 
 	float FaceArea(int faceId)
@@ -70,16 +71,19 @@ public:
 		return 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
 	}
 
-	CDF cdf;
+	// faces weighted by area, so a light sample is uniform over the surface
+	Distribution1D faceDistribution;
 
-	void CalculateAreaAndCDF()
+	void CalculateAreaAndDistribution()
 	{
+		std::vector<float> faceAreas(faces.size());
+		area = 0.0f;
 		for (int i = 0; i < faces.size(); i++)
 		{
-			float thisArea = FaceArea(i);
-			cdf.Add(thisArea);
-			area += thisArea;
+			faceAreas[i] = FaceArea(i);
+			area += faceAreas[i];
 		}
+		faceDistribution.Build(faceAreas);
 	}
 
 	float area;
@@ -142,11 +146,13 @@ public:
 		GenerateTangent();
 
 		aabb = Box(mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z, mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z);
-
-		BuildBVH();
 	}
 
 	void BuildBVH();
+
+	// BuildBVH for many meshes at once, one worker per hardware thread.
+	// Meshes sharing a path share one bvh, as with BuildBVH.
+	static void BuildBVHs(const std::vector<Mesh*>& meshes);
 	
 	void GenerateTangent()
 	{
@@ -187,7 +187,7 @@ public:
 		result->BuildBVH();
 
 		Model* modelResult = new Model(result, 1);
-		modelResult->BuildCDFAndArea();
+		modelResult->BuildDistributionAndArea();
 
 		return modelResult;
 		
@@ -244,7 +244,7 @@ public:
 		result->aabb = Box(-1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f + FLT_EPSILON);
 
 		Model* modelResult = new Model(result, 1);
-		modelResult->BuildCDFAndArea();
+		modelResult->BuildDistributionAndArea();
 
 		return modelResult;
 	}
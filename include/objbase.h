@@ -14,6 +14,7 @@ struct HitInfo;
 struct HitInfoContext;
 struct Interaction;
 class Node;
+class SamplerContext;
 
 //-------------------------------------------------------------------------------
 // Base class for all object types
@@ -22,13 +23,21 @@ class Object
 public:
 	virtual bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const = 0;
 	virtual bool IntersectRay(RayContext& rayContext, HitInfoContext& hInfoContext, int hitSide = HIT_FRONT) const = 0;
+	// true if anything is hit between tMin and tMax, stops at the first hit and computes no surface data
+	virtual bool Occluded(Ray const& ray, float tMin, float tMax, int hitSide = HIT_FRONT) const = 0;
 	virtual Box  GetBoundBox() const = 0;
 	virtual void ViewportDisplay(const Material* mtl) const {}  // used for OpenGL display
 	virtual Vec3f Normal(const Vec3f& p) const
 	{
 		return Vec3f(0.0f, 0.0f, 1.0f);
 	}
-	virtual Interaction Sample() const;
+	// a point on the surface in world space, distributed by area
+	virtual Interaction Sample(SamplerContext& sampler) const;
+	// A point on the surface to light ref with, pdf per unit solid angle seen from ref. Sampled by area
+	// and converted unless the object can sample the solid angle it covers directly.
+	virtual Interaction SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const;
+	// the pdf SampleSolidAngle gives to the surface point it, seen from ref
+	virtual float SolidAnglePdf(const Vec3f& ref, const Interaction& it) const;
 	virtual float Pdf() const
 	{
 		return 1.0f;
@@ -38,6 +47,12 @@ public:
 		return 0.0f;
 	};
 
+	// world space normals lie within acos(cosTheta) of axis, false if they can't be bounded
+	virtual bool NormalBounds(Vec3f& /*axis*/, float& /*cosTheta*/) const
+	{
+		return false;
+	}
+
 	void SetParent(Node* node)
 	{
 		parent = node;
@@ -41,6 +41,13 @@ public:
     virtual Box GetBoundBox() const { return Box(-1,-1,-1,1,1,1); }
     virtual void ViewportDisplay(const Material *mtl) const;
     virtual bool IntersectRay(RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide = HIT_FRONT) const;
+    virtual bool Occluded(Ray const &ray, float tMin, float tMax, int hitSide = HIT_FRONT) const;
+	// light sampling assumes a uniform scale, as the scenes place spheres
+	virtual Interaction Sample(SamplerContext& sampler) const;
+	virtual float Area() const;
+	// uniform over the cone the sphere covers from ref, by area when ref is inside
+	virtual Interaction SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const;
+	virtual float SolidAnglePdf(const Vec3f& ref, const Interaction& it) const;
 };
 
 //-------------------------------------------------------------------------------
@@ -52,13 +59,18 @@ public:
     virtual Box GetBoundBox() const { return Box(-1,-1,0,1,1,0); }
     virtual void ViewportDisplay(const Material *mtl) const;
     virtual bool IntersectRay(RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide = HIT_FRONT) const;
-	virtual Interaction Sample() const;
+    virtual bool Occluded(Ray const &ray, float tMin, float tMax, int hitSide = HIT_FRONT) const;
+	virtual Interaction Sample(SamplerContext& sampler) const;
 	virtual float Area() const;
 	virtual Vec3f Normal(const Vec3f& p) const;
+	virtual bool NormalBounds(Vec3f& axis, float& cosTheta) const;
+	// uniform over the spherical rectangle seen from ref, by area when it is too small, too large or sheared
+	virtual Interaction SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const;
+	virtual float SolidAnglePdf(const Vec3f& ref, const Interaction& it) const;
 };
 //-------------------------------------------------------------------------------
 class MeshBVH;
-class BVHNode;
+struct TriangleHit;
 
 class TriObj : public Object, public cyTriMesh
 {
@@ -67,15 +79,16 @@ public:
     virtual Box GetBoundBox() const { return Box(GetBoundMin(),GetBoundMax()); }
     virtual void ViewportDisplay(const Material *mtl) const;
     virtual bool IntersectRay( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide = HIT_FRONT) const;
+    virtual bool Occluded(Ray const &ray, float tMin, float tMax, int hitSide = HIT_FRONT) const;
     
     bool Load(const char *filename, bool loadMtl);
     
 private:
     MeshBVH* bvh = nullptr;
-    bool IntersectTriangle( const Ray &ray, HitInfo &hInfo, int hitSide, unsigned int faceID ) const;
-    bool TraceBVHNode( Ray const &ray, HitInfo &hInfo, int hitSide, BVHNode* node) const;
+    void FillHitInfo( const Ray &ray, TriangleHit const &hit, HitInfo &hInfo ) const;
+    bool TraceBVH( Ray const &ray, HitInfo &hInfo, int hitSide) const;
     
-    bool IntersectTriangle( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide, unsigned int faceID ) const;
-    bool TraceBVHNode( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide, BVHNode* node) const;
+    void FillHitInfo( RayContext &rayContext, TriangleHit const &hit, HitInfoContext& hInfoContext ) const;
+    bool TraceBVH( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide) const;
 };
 
@@ -4,64 +4,106 @@
 #include <vector>
 #include <future>
 #include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
 
 #include "scene.h"
+#include "tilescheduler.h"
+#include "rng.h"
+#include "film.h"
+#include "lightsampler.h"
+#include "config.h"
 
-class HaltonSampler;
 class RenderWorker;
 
-struct PixelContext
+// When a render stops, the interactive viewer keeps the defaults and stops through outputing.
+struct RenderSettings
 {
-	PixelContext()
-	{
-		offset = Vec2f((static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)));
-	}
-
-	// store current sample count
-	unsigned int CurrentSampleNum = 0;
-	Color color = Color::Black();
-	Vec3f normal = Vec3f(0.0f, 0.0f, 0.0f);
-	float z = 0.0f;
-	Vec2f offset;
+	// 0 leaves one hardware thread for the window
+	unsigned int threadCount = 0;
+	// passes over the image before the workers stop, 0 for no limit
+	unsigned int samplesPerPixel = 0;
+	// seconds, workers finish their current pass once it is exceeded, 0 for no limit
+	float timeBudget = 0.0f;
+	// edge length in pixels of the tiles handed out by the scheduler
+	unsigned int tileSize = 16;
+	// the same seed, scene and sample count give the same image, whatever the thread count
+	uint64_t seed = 0;
+	SamplerType sampler = SamplerType::Sobol;
+	LightSamplerType lightSampler = LightSamplerType::BVH;
+	// auxiliary film layers, AOVType::Light stands for one layer per light
+	std::vector<AOVType> aovs;
+	// Adaptive sampling stops pixels whose relative error falls below the threshold, 0 samples every
+	// pixel in every pass. Every pixel gets at least minSampleCount samples before it is judged.
+	float adaptiveThreshold = 0.0f;
+	unsigned int minSampleCount = MinPixelSampleCount;
+	// The film is saved here between passes, every checkpointInterval seconds and when the render stops.
+	// Empty disables checkpoints.
+	std::string checkpointPath;
+	float checkpointInterval = 300.0f;
+	// continue from checkpointPath if it holds a checkpoint of the same image
+	bool resume = false;
+	// identifies the scene file and camera, checkpoints of anything else are not resumed
+	uint64_t sceneHash = 0;
 };
 
 class PathTracer
 {
 public:
-	void Init(unsigned int _width, unsigned int _height);
+	void Init(unsigned int _width, unsigned int _height, const RenderSettings& _settings = RenderSettings());
 	void Run();
 	void Join();
+
+	// totals over all workers, valid after Join
+	unsigned long long GetSampleCount() const;
+	unsigned int GetPassCount() const;
+	float GetRenderTime() const;
+
+	// Marks converged pixels and drops tiles without any pixel left to sample from the next passes.
+	// Called between passes, false once the whole image converged.
+	bool UpdateConvergence();
+
+	// Called by the last worker to finish a pass, with the passes completed so far including resumed
+	// ones. Saves a checkpoint when one is due, true when rendering should stop.
+	bool EndPass(unsigned int passCount);
+private:
+	bool SaveCheckpoint(unsigned int passCount);
+	bool ResumeFromCheckpoint();
 public:
 	unsigned int width = 0;
 	unsigned int height = 0;
 	unsigned int size = 0;
 
-	std::vector<PixelContext> pixelData;
-	HaltonSampler* haltonSampler;
+	RenderSettings settings;
+	std::chrono::steady_clock::time_point startTime;
+	std::chrono::steady_clock::time_point endTime;
+
+	TileScheduler scheduler;
+	// per pixel, only written between passes
+	std::vector<bool> converged;
 	std::vector<RenderWorker*> workers;
+	// passes already in the film when the render was resumed
+	unsigned int resumedPassCount = 0;
+	std::chrono::steady_clock::time_point lastCheckpoint;
 };
 
 class RenderWorker 
 {
 public:
-	RenderWorker(int _index, int _cores, PathTracer* _render);
+	RenderWorker(int _index, PathTracer* _render);
 	
 	void Run();
 	void Join();
 
-	int originalIndex;
-	int cores;
+	int index;
+	PathTracer* render;
+	unsigned long long sampleCount = 0;
+	std::unique_ptr<SamplerContext> sampler;
+	// reused for every sample, so the per light buffer is only allocated once
+	PixelContext sample;
 	std::thread* thread;
-	HaltonSampler* haltonSampler;
-	std::vector<PixelContext> pixelData;
-
-	std::mutex mtx;
 
-	unsigned int width = 0;
-	unsigned int height = 0;
-	unsigned int size = 0;
+private:
+	void RenderTile(const Tile& tile);
 };
-
-
-
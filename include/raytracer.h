@@ -4,15 +4,23 @@
 #include "cyVector.h"
 #include "scene.h"
 #include "config.h"
+#include "pathtracer.h"
 #include <mutex>
 #include <atomic>
 
+// any hit between tMin and tMax, the object of ignoreNode is skipped
+bool Occluded(Ray const& ray, float tMin, float tMax, Node const* ignoreNode = nullptr);
+// nearest hit with a single node's object, in world space
+bool IntersectNode(Ray const& ray, HitInfo& hitInfo, Node const* node, int side = HIT_FRONT);
 bool LightVisTest(Ray& ray, HitInfo& hitInfo, float t_max, Node* light);
-Ray GenCameraRay(int x, int y, float xOffset = 0.5f, float yOffset = 0.5f, bool normalize = true);
+// lensSample in [0, 1)^2 picks the point on the aperture
+Ray GenCameraRay(int x, int y, float xOffset, float yOffset, Vec2f lensSample, bool normalize = true);
 bool GenerateRayForAnyIntersection(Ray& ray, float t_max = BIGFLOAT);
 bool GenerateRayForNearestIntersection(RayContext& ray, HitInfoContext& hitinfoContext, int side, float& t);
 bool TraceNode(HitInfoContext& hitInfoContext, RayContext& rayContext, Node* node, int side = HIT_FRONT);
-RayContext GenCameraRayContext(int x, int y, float offsetX, float offsetY);
+// nearest hit against the whole scene, through the top level acceleration structure once it is built
+bool TraceScene(HitInfoContext& hitInfoContext, RayContext& rayContext, int side = HIT_FRONT);
+RayContext GenCameraRayContext(int x, int y, float offsetX, float offsetY, Vec2f lensSample);
 
 class Node;
 class Filter;
@@ -24,11 +32,17 @@ class RayTracer
 {
     public:
 
-    void Init();
+    // false when the scene could not be loaded
+    bool Init();
     void Run();
+    // renders without a window until settings.samplesPerPixel or settings.timeBudget is reached,
+    // writes outputPath and returns the process exit code
+    int RunHeadless();
 	void Restart();
     void UpdateRenderResult();
-    void WriteToFile();
+    // denoises the current film into the filter texture
+    void UpdateDenoisedResult();
+    bool WriteToFile();
 	void Pause();
     
     std::shared_ptr<Texture2D> GetZBufferTexture(){return zbufferTexture;}
@@ -38,9 +52,29 @@ class RayTracer
     std::shared_ptr<Texture2D> GetFilterTexture(){return filterTexture;}
 	std::shared_ptr<Texture2D> GetIrradianceTexture() { return irradianceTexture; }
     
-    char* scene_path = ScenePath;
+    std::string scene_path = ScenePath;
+    std::string outputPath = "colorbuffer.png";
+    // no window, so no textures to upload the results to
+    bool headless = false;
+    // headless renders are denoised before they are written
+    bool denoise = false;
+    RenderSettings settings;
     
 private:
+    void InitTextures();
+    // registers settings.aovs and the layers the viewer shows
+    void InitFilmLayers();
+    // builds the structures next event estimation picks lights and environment directions from
+    void InitLightSampler();
+    // FNV-1a over the scene file and the camera, written into checkpoints
+    uint64_t HashScene() const;
+
+    // statistics of the last Run
+    unsigned long long renderedSamples = 0;
+    unsigned int renderedPasses = 0;
+    float renderTime = 0.0f;
+    std::vector<Color> denoised;
+
     GaussianFilter* gaussianFilter;
    // ColorShiftFilter* colorShiftFilter;
     std::shared_ptr<Texture2D> zbufferTexture;
@@ -8,12 +8,14 @@
 #include "materials.h"
 
 #include "lightcomponent.h"
-#include "tonemapping.h"
+#include "lightsampler.h"
+#include "environmentlight.h"
 
 extern LightComList lightList;
+extern LightSampler lightSampler;
+extern EnvironmentLight environmentLight;
 extern Node rootNode;
 extern TexturedColor environment;
-ToneMapping toneMapping;
 
 float PowerHeuristic(int numf, float fPdf, int numg, float gPdf) 
 {
@@ -23,7 +25,9 @@ float PowerHeuristic(int numf, float fPdf, int numg, float gPdf)
 	return (f * f) / (f * f + g * g);
 }
 
-Color EstimateDirect(LightComponent* light, Material* material, HitInfo& hitinfo, Vec3f& wo)
+// selectLightPdf is the probability of having picked light. The brdf sample below only counts when
+// it hits that light, so both strategies carry it and it cancels out of the weights.
+Color EstimateDirect(LightComponent* light, float selectLightPdf, Material* material, HitInfo& hitinfo, Vec3f& wo, SamplerContext& sampler)
 {
 	Color directResult = Color::Black();
 
@@ -45,14 +49,15 @@ Color EstimateDirect(LightComponent* light, Material* material, HitInfo& hitinfo
 		float pdf;
 		Vec3f wi;
 
-		Color Li = light->SampleLi(hitinfo, pdf, wi);
+		Color Li = light->SampleLi(hitinfo, pdf, wi, sampler);
+		pdf *= selectLightPdf;
 
 		if (pdf > 0.0f && Li.Max() > 0.0f)
 		{
 			Vec3f brdfN;
 			Color f = material->EvalBrdf(hitinfo, wi, wo, brdfN);
 			float NdotL = Max<float>(brdfN.Dot(wi), 0.0f);
-			float brdfPdf = material->ComputePdf(hitinfo, wi, wo);
+			float brdfPdf = material->ComputePdf(hitinfo, wi, wo) * selectLightPdf;
 
 			if (brdfPdf > 0.0f)
 			{
@@ -65,12 +70,13 @@ Color EstimateDirect(LightComponent* light, Material* material, HitInfo& hitinfo
 	{
 		float pdf;
 		Vec3f wi;
-		material->Sample(hitinfo, wi, wo, pdf);
+		material->Sample(hitinfo, wi, wo, pdf, sampler);
+		pdf *= selectLightPdf;
 		Vec3f brdfN;
 		Color f = material->EvalBrdf(hitinfo, wi, wo, brdfN);
 		if (pdf > 0.0f && f.Sum() > 0.0f)
 		{
-			float lightPdf = light->Pdf(hitinfo, wi);
+			float lightPdf = light->Pdf(hitinfo, wi) * selectLightPdf;
 			if (lightPdf <= 0.0f)
 			{
 				return directResult;
@@ -84,32 +90,69 @@ Color EstimateDirect(LightComponent* light, Material* material, HitInfo& hitinfo
 	return directResult;
 }
 
-Color SampleLights(LightComponent* hitLight, Material* material, HitInfo& hitinfo, Vec3f& wo)
+// sampledLight is the index of the light the result came from, -1 if none
+Color SampleLights(LightComponent* hitLight, Material* material, HitInfo& hitinfo, Vec3f& wo, SamplerContext& sampler, int& sampledLight)
 {
-	int numLights = lightList.size();
 	Color result = Color::Black();
+	sampledLight = -1;
 
-	float selectLightPdf = 1.0f / numLights;
-
-	int lightIndex = RandomIndexElementInList(numLights);
-	
-	auto light = lightList[lightIndex];
-	if (light == hitLight)
+	// the light that was hit can't light its own point, the others share its probability
+	int hitLightIndex = hitLight != nullptr ? (int)hitLight->index : -1;
+	float selectLightPdf;
+	int lightIndex = lightSampler.Sample(hitinfo.p, hitinfo.N, sampler.Next1D(), hitLightIndex, selectLightPdf);
+	if (lightIndex < 0 || selectLightPdf <= 0.0f)
 	{
 		return result;
 	}
 
-	result = result + (EstimateDirect(light, material, hitinfo, wo) / selectLightPdf);
+	result = EstimateDirect(lightList[lightIndex], selectLightPdf, material, hitinfo, wo, sampler);
+	sampledLight = lightIndex;
 	
 	return result;
 }
 
-PixelContext RenderPixel(RayContext& rayContext, int x, int y)
+// Next event estimation towards the environment. The brdf strategy is the sample that continues the
+// path, RenderPixel weights what it finds when the path escapes.
+Color SampleEnvironmentLight(Material* material, HitInfo& hitinfo, Vec3f& wo, SamplerContext& sampler)
+{
+	if (environmentLight.Empty())
+	{
+		return Color::Black();
+	}
+
+	float pdf;
+	Vec3f wi = environmentLight.Sample(sampler.Next2D(), pdf);
+	if (pdf <= 0.0f)
+	{
+		return Color::Black();
+	}
+
+	Vec3f brdfN;
+	Color f = material->EvalBrdf(hitinfo, wi, wo, brdfN);
+	float NdotL = Max<float>(brdfN.Dot(wi), 0.0f);
+	if (NdotL <= 0.0f || f.Sum() <= 0.0f)
+	{
+		return Color::Black();
+	}
+
+	if (Occluded(Ray(hitinfo.p + hitinfo.N * INTERSECTION_BIAS, wi), 0.0f, BIGFLOAT))
+	{
+		return Color::Black();
+	}
+
+	float brdfPdf = material->ComputePdf(hitinfo, wi, wo);
+	float weight = PowerHeuristic(1.0f, pdf, 1.0f, brdfPdf);
+	return NdotL * f * environment.SampleEnvironment(wi) * weight / pdf;
+}
+
+// fills result, result.lights keeps the size Film::PrepareSample gave it
+void RenderPixel(RayContext& rayContext, int x, int y, SamplerContext& sampler, PixelContext& result)
 {
 	if (x == 482 && y == 356)
 	{
 		int a = 1;
 	}
+	result.Reset();
 	HitInfoContext hitInfoContext;
 
 	Color color = Color::Black();
@@ -117,13 +160,21 @@ PixelContext RenderPixel(RayContext& rayContext, int x, int y)
 	Vec3f position;
 	Vec3f normal;
 	Vec3f outputDirection;
+	// pdf of the brdf sample the current ray came from, unused for the camera ray
+	float brdfPdf = 0.0f;
 
 	for (int bounces = 0; bounces < IndirectLightBounceCount; bounces++)
 	{
-		bool sthTraced = TraceNode(hitInfoContext, rayContext, &rootNode, HIT_FRONT_AND_BACK);
+		bool sthTraced = TraceScene(hitInfoContext, rayContext, HIT_FRONT_AND_BACK);
 		if (!sthTraced)
 		{
-			color += throughput * environment.SampleEnvironment(rayContext.cameraRay.dir);
+			// the environment was also sampled directly at the previous hit
+			float weight = 1.0f;
+			if (bounces > 0 && !environmentLight.Empty())
+			{
+				weight = PowerHeuristic(1.0f, brdfPdf, 1.0f, environmentLight.Pdf(rayContext.cameraRay.dir));
+			}
+			color += throughput * environment.SampleEnvironment(rayContext.cameraRay.dir) * weight;
 			break;
 		}
 
@@ -138,6 +189,10 @@ PixelContext RenderPixel(RayContext& rayContext, int x, int y)
 		if (light != nullptr && bounces == 0)
 		{
 			color += throughput * light->Le();
+			if (light->index < result.lights.size())
+			{
+				result.lights[light->index] += throughput * light->Le();
+			}
 		}
 
 		position = hitinfo.p;
@@ -145,11 +200,27 @@ PixelContext RenderPixel(RayContext& rayContext, int x, int y)
 		outputDirection = -1.0f * rayContext.cameraRay.dir;
 		outputDirection.Normalize();
 
-		color += throughput * SampleLights(light, material, hitinfo, outputDirection);
+		if (bounces == 0)
+		{
+			result.albedo = material->GetAlbedo(hitinfo);
+			result.normal = normal.GetNormalized();
+			result.position = position;
+			result.z = hitinfo.z;
+		}
+
+		int sampledLight;
+		Color direct = throughput * SampleLights(light, material, hitinfo, outputDirection, sampler, sampledLight);
+		color += direct;
+		if (sampledLight >= 0 && sampledLight < (int)result.lights.size())
+		{
+			result.lights[sampledLight] += direct;
+		}
+		color += throughput * SampleEnvironmentLight(material, hitinfo, outputDirection, sampler);
 
 		Vec3f wi;
 		float pdf;
-		material->Sample(hitinfo, wi,outputDirection, pdf);
+		material->Sample(hitinfo, wi,outputDirection, pdf, sampler);
+		brdfPdf = pdf;
 		
 		Vec3f shadingNormal;
 		auto f = material->EvalBrdf(hitinfo, wi, outputDirection, shadingNormal);
@@ -187,7 +258,7 @@ PixelContext RenderPixel(RayContext& rayContext, int x, int y)
 		if (bounces > 3)
 		{
 			float p = Max(throughput.Max(), 0.001f);
-			float random = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+			float random = sampler.Next1D();
 			if (random > p)
 			{
 				break;
@@ -220,27 +291,12 @@ PixelContext RenderPixel(RayContext& rayContext, int x, int y)
 	{
 		spdlog::info("Invalid Color, Set it to zero");
 		color.SetBlack();
+		for (Color& lightColor : result.lights)
+		{
+			lightColor.SetBlack();
+		}
 	}
 
-	PixelContext tempSampleResult;
-	tempSampleResult.color = color;
-	tempSampleResult.z = hitInfoContext.mainHitInfo.z;
-	tempSampleResult.normal = hitInfoContext.mainHitInfo.N;
-
-	auto& resultColor = tempSampleResult.color;
-
-	// Exposure tone mapping
-	Color mappedColor =
-		//toneMapping.Clamp(resultColor.ToVec());
-		toneMapping.ACES(resultColor.ToVec());
-		// resultColor;
-	/*	Color(
-			1.0f - exp(-resultColor.r * exposure),
-			1.0f - exp(-resultColor.g * exposure),
-			1.0f - exp(-resultColor.b * exposure));*/
-
-	// gamma correction
-	tempSampleResult.color = Color(powf(mappedColor.r, 0.4545f), powf(mappedColor.g, 0.4545f), powf(mappedColor.b, 0.4545f));
-	// tempSampleResult.color = mappedColor;
-	return tempSampleResult;
+	// linear, tone mapping happens when the film is resolved
+	result.color = color;
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include "cyVector.h"
+
+using namespace cy;
+
+// PCG32 (XSH RR variant), 64 bit LCG state with a permuted 32 bit output.
+// Small enough to live on the stack of every pixel sample.
+class PCG32
+{
+public:
+	PCG32()
+	{
+		Seed(0, 0);
+	}
+
+	PCG32(uint64_t initState, uint64_t initSequence)
+	{
+		Seed(initState, initSequence);
+	}
+
+	// initSequence selects one of 2^63 independent streams
+	void Seed(uint64_t initState, uint64_t initSequence)
+	{
+		state = 0u;
+		inc = (initSequence << 1u) | 1u;
+		NextUInt();
+		state += initState;
+		NextUInt();
+	}
+
+	uint32_t NextUInt()
+	{
+		uint64_t oldState = state;
+		state = oldState * 6364136223846793005ull + inc;
+		uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+		uint32_t rotation = (uint32_t)(oldState >> 59u);
+		return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1u) & 31));
+	}
+
+	// [0, 1), the top 24 bits so the result is exact and never rounds up to 1
+	float NextFloat()
+	{
+		return (float)(NextUInt() >> 8) * 0x1p-24f;
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+// splitmix64 finalizer, spreads nearby seeds over the whole state space
+inline uint64_t MixBits(uint64_t v)
+{
+	v ^= v >> 31;
+	v *= 0x7fb5d329728ea185ull;
+	v ^= v >> 27;
+	v *= 0x81dadef4bc2dd44dull;
+	v ^= v >> 33;
+	return v;
+}
+
+inline unsigned int ReverseBits32(unsigned int v)
+{
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+	v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+// Radical inverse of index. Base 2 is a bit reversal, other bases gather the digits
+// as an integer and divide once, instead of a float division per digit.
+inline float Halton(int index, int base)
+{
+	if (base == 2)
+	{
+		return (float)(ReverseBits32((unsigned int)index) >> 8) * 0x1p-24f;
+	}
+	unsigned long long reversed = 0;
+	unsigned long long scale = 1;
+	for (unsigned int i = (unsigned int)index; i > 0; )
+	{
+		unsigned int next = i / (unsigned int)base;
+		reversed = reversed * base + (i - next * base);
+		scale *= base;
+		i = next;
+	}
+	float r = (float)((double)reversed / (double)scale);
+	return r < 0x1.fffffep-1f ? r : 0x1.fffffep-1f;
+}
+
+enum class SamplerType
+{
+	Random,
+	Sobol
+};
+
+// Supplies the random numbers of one pixel sample, passed down the whole path. Each worker owns one
+// and restarts it for every pixel sample. Implementations only depend on the pixel, the sample index
+// and the render seed, so a frame comes out bit for bit the same no matter which thread renders which tile.
+class SamplerContext
+{
+public:
+	virtual ~SamplerContext() {}
+
+	virtual void StartSample(unsigned int pixelIndex, unsigned int sampleIndex) = 0;
+
+	// position inside the pixel, [0, 1)^2, drawn once at the start of the sample
+	virtual Vec2f GetPixel2D() = 0;
+
+	// the following dimensions in the order the path consumes them
+	virtual float Next1D() = 0;
+	virtual Vec2f Next2D() = 0;
+};
+
+// Independent PCG32 numbers per pixel sample. The pixel position is the Halton (2, 3) sequence,
+// rotated per pixel, as the path tracer always did.
+class RandomSampler : public SamplerContext
+{
+public:
+	explicit RandomSampler(uint64_t _seed = 0)
+		:seed(MixBits(_seed))
+	{
+	}
+
+	void StartSample(unsigned int _pixelIndex, unsigned int _sampleIndex) override
+	{
+		pixelIndex = _pixelIndex;
+		sampleIndex = _sampleIndex;
+		rng.Seed(MixBits(((uint64_t)pixelIndex << 32) ^ sampleIndex ^ seed), pixelIndex);
+	}
+
+	Vec2f GetPixel2D() override
+	{
+		// the rotation has a stream of its own, it must be the same for every sample of the pixel
+		PCG32 rotationRng(MixBits(((uint64_t)pixelIndex << 32) ^ 0xffffffffull ^ seed), pixelIndex);
+		float x = Halton(sampleIndex, 2) + rotationRng.NextFloat();
+		float y = Halton(sampleIndex, 3) + rotationRng.NextFloat();
+		return Vec2f(x >= 1.0f ? x - 1.0f : x, y >= 1.0f ? y - 1.0f : y);
+	}
+
+	float Next1D() override
+	{
+		return rng.NextFloat();
+	}
+
+	Vec2f Next2D() override
+	{
+		float x = rng.NextFloat();
+		float y = rng.NextFloat();
+		return Vec2f(x, y);
+	}
+
+private:
+	uint64_t seed;
+	unsigned int pixelIndex = 0;
+	unsigned int sampleIndex = 0;
+	PCG32 rng;
+};
@@ -3,51 +3,48 @@
 #include "scene.h"
 #include <vector>
 #include <random>
-#include <mutex> 
+#include <atomic>
 
 #include "pathtracer.h"
+#include "rng.h"
+#include "utils.h"
 
 #define ONE_MINUS_EPSILON 0x1.fffffep-1
 
-class HaltonSampler{
-public:
-    
-    HaltonSampler();
-    
-	RayContext SamplePixel(int x, int y, Vec2f& randomOffset, int index) const;
-    
-private:
- 
-    int haltonXBase = 2;
-    int haltonYBase = 3;
-    std::mt19937_64 rng;
-};
+SamplerContext* CreateSampler(SamplerType type, uint64_t seed);
+
+// camera ray through the sampler's position inside pixel (x, y)
+RayContext SamplePixel(int x, int y, SamplerContext& sampler);
+
+inline unsigned int NextIndex(std::atomic<unsigned int>& index)
+{
+	return index.fetch_add(1, std::memory_order_relaxed);
+}
 
+// Halton (2, 3) points with a random rotation. The sequence indices are advanced with relaxed
+// atomics: a caller only needs an index nobody else got, not any ordering with other memory,
+// so one instance can be shared by all render threads without a lock.
 // 0 to 1
 class Quasy2DSampler
 {
 public:
 	Quasy2DSampler()
 	{
-		xOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
-		yOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+		xOffset = RandomFloat();
+		yOffset = RandomFloat();
 	}
 	Vec2f GenRandom2DVector()
 	{
-		float x = Halton(xIndex, haltonXBase) + xOffset;
-		mtx.lock();
-		xIndex++;
-		mtx.unlock();
-		if (x > 1.0f)
+		unsigned int index = NextIndex(pointIndex);
+
+		float x = Halton(index, haltonXBase) + xOffset;
+		if (x >= 1.0f)
 		{
 			x -= 1.0f;
 		}
 
-		float y = Halton(yIndex, haltonYBase) + yOffset;
-		mtx.lock();
-		yIndex++;
-		mtx.unlock();
-		if (y > 1.0f)
+		float y = Halton(index, haltonYBase) + yOffset;
+		if (y >= 1.0f)
 		{
 			y -= 1.0f;
 		}
@@ -57,11 +54,9 @@ public:
 private:
 	float xOffset = 0.0f;
 	float yOffset = 0.0f;
-	int xIndex = 0;
-	int yIndex = 0;
+	std::atomic<unsigned int> pointIndex{ 0 };
 	int haltonXBase = 2;
 	int haltonYBase = 3;
-	std::mutex mtx;
 };
 
 class QuasyMonteCarloCircleSampler 
@@ -69,19 +64,15 @@ class QuasyMonteCarloCircleSampler
 public:
 	QuasyMonteCarloCircleSampler()
 	{
-		thetaOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * Pi<float>() * 2.0f;
-		sOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+		thetaOffset = RandomFloat() * Pi<float>() * 2.0f;
+		sOffset = RandomFloat();
 	}
 
 	float RandomGlossAngleFactor()
 	{
-		float result = Halton(sIndex, haltonSBase) + sOffset;
-		
-		mtx.lock();
-		sIndex++;
-		mtx.unlock();
+		float result = Halton(NextIndex(sIndex), haltonSBase) + sOffset;
 
-		if (result > 1.0f)
+		if (result >= 1.0f)
 		{
 			result -= 1.0f;
 		}
@@ -90,13 +81,9 @@ public:
 
 	float RandomTheta()
 	{
-		float result = Halton(thetaIndex, haltonThetaBase) + sOffset;
-		
-		mtx.lock();
-		thetaIndex++;
-		mtx.unlock();
+		float result = Halton(NextIndex(thetaIndex), haltonThetaBase) + sOffset;
 
-		if (result > 1.0f)
+		if (result >= 1.0f)
 		{
 			result -= 1.0f;
 		}
@@ -106,23 +93,20 @@ public:
 
 	Vec2f RandomPointInCircle(float radius)
 	{
+		// one index for both coordinates, so the point is a proper (2, 3) Halton pair
+		unsigned int index = NextIndex(pointIndex);
+
 		// generate a random value between 0 to Radius as the value of Cumulative Distribution Function
-		float S = Halton(sIndex, haltonSBase) + sOffset;
-		mtx.lock();
-		sIndex++;
-		mtx.unlock();
+		float S = Halton(index, haltonSBase) + sOffset;
 
-		if (S > 1.0f)
+		if (S >= 1.0f)
 		{
 			S -= 1.0f;
 		}
 		// S = r2 / R2, choose r based on F
 		float r = sqrtf(S) * radius;
 
-		float theta = Halton(thetaIndex, haltonThetaBase) * Pi<float>() * 2.0f + thetaOffset;
-		mtx.lock();
-		thetaIndex++;
-		mtx.unlock();
+		float theta = Halton(index, haltonThetaBase) * Pi<float>() * 2.0f + thetaOffset;
 
 		if (theta > (Pi<float>() * 2.0f))
 		{
@@ -141,10 +125,9 @@ public:
 	int haltonSBase = 2;
 	int haltonThetaBase = 3;
 
-	int sIndex = 0;
-	int thetaIndex = 0;
-
-	std::mutex mtx;
+	std::atomic<unsigned int> sIndex{ 0 };
+	std::atomic<unsigned int> thetaIndex{ 0 };
+	std::atomic<unsigned int> pointIndex{ 0 };
 };
 
 class QuasyMonteCarloHemiSphereSampler
@@ -152,15 +135,16 @@ class QuasyMonteCarloHemiSphereSampler
 public:
 	QuasyMonteCarloHemiSphereSampler()
 	{
-		BetaOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* Pi<float>() * 2.0f;
-		FOffset = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+		BetaOffset = RandomFloat()* Pi<float>() * 2.0f;
+		FOffset = RandomFloat();
 	}
 
 	Vec3f CosineWeightedSample()
 	{
-		float F = Halton(FIndex, FBase) + FOffset;
-		FIndex++;
-		if (F > 1.0f)
+		unsigned int index = NextIndex(sampleIndex);
+
+		float F = Halton(index, FBase) + FOffset;
+		if (F >= 1.0f)
 		{
 			F -= 1.0f;
 		}
@@ -170,8 +154,7 @@ public:
 		float cosTheta = cos(theta);
 		float sinTheta = sin(theta);
 
-		float beta = Halton(BetaIndex, BetaBase) * Pi<float>() * 2.0f + BetaOffset;
-		BetaIndex++;
+		float beta = Halton(index, BetaBase) * Pi<float>() * 2.0f + BetaOffset;
 		if (beta > Pi<float>() * 2.0f)
 		{
 			beta -= Pi<float>() * 2.0f;
@@ -184,8 +167,7 @@ public:
 private:
 	float FOffset = 0.0f;
 	float BetaOffset = 0.0f;
-	int FIndex = 0;
-	int BetaIndex = 0;
+	std::atomic<unsigned int> sampleIndex{ 0 };
 	int FBase = 2;
 	int BetaBase = 3;
 };
\ No newline at end of file
@@ -42,6 +42,7 @@
 #include "ray.h"
 #include "hitinfo.h"
 #include "materials.h"
+#include "rng.h"
 
 using namespace cy;
 
@@ -59,17 +60,6 @@ using namespace cy;
 
 #define RAY_DIFF_DELTA 1.0f
 
-inline float Halton(int index, int base)
-{
-    float r = 0;
-    float f = 1.0f / (float)base;
-    for ( int i=index; i>0; i/=base ) {
-        r += f * (i%base);
-        f /= (float) base;
-    }
-    return r;
-}
-
 //-------------------------------------------------------------------------------
 
 class Node;
@@ -183,6 +173,9 @@ public:
     }
     
     virtual bool SetViewportTexture() const { return false; }   // used for OpenGL display
+
+    // size in texels, false for procedural textures
+    virtual bool GetResolution(int &/*width*/, int &/*height*/) const { return false; }
     
 protected:
     
@@ -242,6 +235,7 @@ public:
 	}
     
     bool SetViewportTexture() const { if ( texture ) return texture->SetViewportTexture(); return false; }   // used for OpenGL display
+    bool GetResolution(int &width, int &height) const { return texture != nullptr && texture->GetResolution(width, height); }
     
 private:
     Texture *texture;
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "bvh.h"
+#include "node.h"
+#include "hitinfo.h"
+#include <vector>
+#include <map>
+
+class Material;
+
+// One placed object, its node transformation chain folded into a single world transformation.
+struct SceneInstance : public Transformation
+{
+	Node* node = nullptr;
+	Object* obj = nullptr;
+	Material* mtl = nullptr;
+
+	Ray ToLocal(Ray const& ray) const
+	{
+		Ray r;
+		r.p = TransformTo(ray.p);
+		r.dir = TransformTo(ray.p + ray.dir) - r.p;
+		return r;
+	}
+
+	RayContext ToLocal(RayContext const& rayContext) const
+	{
+		RayContext result;
+
+		result.cameraRay = ToLocal(rayContext.cameraRay);
+		result.rightRay = ToLocal(rayContext.rightRay);
+		result.topRay = ToLocal(rayContext.topRay);
+		result.delta = rayContext.delta;
+		result.hasDiff = rayContext.hasDiff;
+
+		return result;
+	}
+
+	void FromLocal(HitInfo& hInfo) const
+	{
+		hInfo.p = TransformFrom(hInfo.p);
+		hInfo.N = VectorTransformFrom(hInfo.N).GetNormalized();
+		hInfo.Tangent = VectorTransformFrom(hInfo.Tangent).GetNormalized();
+		hInfo.Bitangent = VectorTransformFrom(hInfo.Bitangent).GetNormalized();
+	}
+
+	void FromLocal(HitInfoContext& hInfoContext) const
+	{
+		FromLocal(hInfoContext.mainHitInfo);
+		FromLocal(hInfoContext.rightHitInfo);
+		FromLocal(hInfoContext.topHitInfo);
+	}
+};
+
+// Top level acceleration structure, a BVH over the world space bounds of every node that holds an object.
+// The per mesh BVHs are the bottom level, reached through Object::IntersectRay in instance space.
+class SceneAccel
+{
+public:
+	void Build(Node* root);
+	void Clear();
+
+	bool IsEmpty() const
+	{
+		return instances.empty();
+	}
+
+	size_t GetInstanceCount() const
+	{
+		return instances.size();
+	}
+
+	float GetBuildTime() const
+	{
+		return buildSeconds;
+	}
+
+	// Nearest hit in world space, fills node and mtl like TraceNode does.
+	bool Trace(HitInfoContext& hitInfoContext, RayContext& rayContext, int side = HIT_FRONT) const;
+
+	// Any hit between tMin and tMax, objects of ignoreNode are skipped. Only distances are computed.
+	bool Occluded(Ray const& ray, float tMin, float tMax, Node const* ignoreNode = nullptr, int side = HIT_FRONT) const;
+
+	// Nearest hit with the object of a single node, in world space.
+	bool IntersectNode(Ray const& ray, HitInfo& hitInfo, Node const* node, int side = HIT_FRONT) const;
+
+	const std::vector<SceneInstance>& GetInstances() const
+	{
+		return instances;
+	}
+
+private:
+	void CollectInstances(Node* node, Matrix3f const& parentTm, Vec3f const& parentPos);
+
+	std::vector<SceneInstance> instances;
+	// instances without a finite bound box, tested for every ray
+	std::vector<unsigned int> unbounded;
+	std::map<Node const*, unsigned int> nodeInstances;
+	// build time only, bounds of the finite instances and their index in instances
+	std::vector<BVHBound> instanceBounds;
+	std::vector<unsigned int> instanceIds;
+	LinearBVH bvh;
+	float buildSeconds = 0.0f;
+};
+
+extern SceneAccel sceneAccel;
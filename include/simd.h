@@ -0,0 +1,164 @@
+#pragma once
+
+#include "cyVector.h"
+#include "ray.h"
+
+using namespace cy;
+
+// SSE2 is part of x86-64, so the 4 wide kernels need no runtime check there. The 8 wide AVX2
+// kernel is compiled separately and only picked when the cpu reports support for it.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_X86 1
+#include <emmintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+enum class SIMDLevel
+{
+	Scalar,
+	SSE,
+	AVX2
+};
+
+// Detected once, RAYTRACER_SIMD=scalar|sse|avx2 in the environment caps it for comparisons.
+SIMDLevel GetSIMDLevel();
+const char* GetSIMDLevelName(SIMDLevel level);
+
+// Per ray data shared by every box and triangle test of a traversal, reciprocal direction included.
+struct SIMDRay
+{
+	SIMDRay(Ray const& ray)
+	{
+		origin[0] = ray.p.x;
+		origin[1] = ray.p.y;
+		origin[2] = ray.p.z;
+		origin[3] = 0.0f;
+
+		dir[0] = ray.dir.x;
+		dir[1] = ray.dir.y;
+		dir[2] = ray.dir.z;
+		dir[3] = 0.0f;
+
+		for (int i = 0; i < 3; i++)
+		{
+			invDir[i] = 1.0f / dir[i];
+			dirIsNeg[i] = invDir[i] < 0.0f;
+		}
+		invDir[3] = 0.0f;
+	}
+
+	alignas(16) float origin[4];
+	alignas(16) float dir[4];
+	alignas(16) float invDir[4];
+	int dirIsNeg[3];
+};
+
+// Slab test against bound = {minx, miny, minz, maxx, maxy, maxz}, one axis per lane.
+// The two loads read one float past the bound, callers keep at least that much after it.
+inline bool IntersectBoundSIMD(const float* bound, SIMDRay const& ray, float tMax, float& tNear)
+{
+#if SIMD_X86
+	__m128 origin = _mm_load_ps(ray.origin);
+	__m128 invDir = _mm_load_ps(ray.invDir);
+
+	__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bound), origin), invDir);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bound + 3), origin), invDir);
+
+	__m128 tLow = _mm_min_ps(t0, t1);
+	__m128 tHigh = _mm_max_ps(t0, t1);
+
+	// reduce lanes x, y, z, the fourth lane holds whatever follows the bound
+	__m128 nearXY = _mm_max_ss(tLow, _mm_shuffle_ps(tLow, tLow, _MM_SHUFFLE(1, 1, 1, 1)));
+	__m128 nearXYZ = _mm_max_ss(nearXY, _mm_shuffle_ps(tLow, tLow, _MM_SHUFFLE(2, 2, 2, 2)));
+	__m128 farXY = _mm_min_ss(tHigh, _mm_shuffle_ps(tHigh, tHigh, _MM_SHUFFLE(1, 1, 1, 1)));
+	__m128 farXYZ = _mm_min_ss(farXY, _mm_shuffle_ps(tHigh, tHigh, _MM_SHUFFLE(2, 2, 2, 2)));
+
+	tNear = _mm_cvtss_f32(nearXYZ);
+	float tFar = _mm_cvtss_f32(farXYZ);
+#else
+	float tFar = BIGFLOAT;
+	tNear = -BIGFLOAT;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float t0 = (bound[axis] - ray.origin[axis]) * ray.invDir[axis];
+		float t1 = (bound[axis + 3] - ray.origin[axis]) * ray.invDir[axis];
+		if (t0 > t1)
+		{
+			float swap = t0;
+			t0 = t1;
+			t1 = swap;
+		}
+		tNear = t0 > tNear ? t0 : tNear;
+		tFar = t1 < tFar ? t1 : tFar;
+	}
+#endif
+	return tNear <= tFar && tNear < tMax && tFar > 0.0f;
+}
+
+// Slab test against four boxes at once, bounds[axis][lane] holds the minimum and bounds[3 + axis][lane]
+// the maximum. Returns one bit per lane hit closer than tMax, inverted (empty) boxes never hit.
+inline int IntersectBounds4(const float bounds[6][4], SIMDRay const& ray, float tMax)
+{
+#if SIMD_X86
+	__m128 tNear = _mm_setzero_ps();
+	__m128 tFar = _mm_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		// near and far planes picked by the direction sign, so an inverted box ends up with tNear > tFar
+		const float* nearPlane = bounds[ray.dirIsNeg[axis] ? axis + 3 : axis];
+		const float* farPlane = bounds[ray.dirIsNeg[axis] ? axis : axis + 3];
+		__m128 origin = _mm_set1_ps(ray.origin[axis]);
+		__m128 invDir = _mm_set1_ps(ray.invDir[axis]);
+
+		// computed value first, a NaN from 0 * inf then keeps the running bound
+		tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearPlane), origin), invDir), tNear);
+		tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farPlane), origin), invDir), tFar);
+	}
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+	int mask = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		float tNear = 0.0f;
+		float tFar = tMax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float nearPlane = bounds[ray.dirIsNeg[axis] ? axis + 3 : axis][lane];
+			float farPlane = bounds[ray.dirIsNeg[axis] ? axis : axis + 3][lane];
+			float t0 = (nearPlane - ray.origin[axis]) * ray.invDir[axis];
+			float t1 = (farPlane - ray.origin[axis]) * ray.invDir[axis];
+			tNear = t0 > tNear ? t0 : tNear;
+			tFar = t1 < tFar ? t1 : tFar;
+		}
+		if (tNear <= tFar)
+		{
+			mask |= 1 << lane;
+		}
+	}
+	return mask;
+#endif
+}
+
+// Four triangles in SoA form, v0 and the two edges per axis. Unused lanes have zero edges and never hit.
+struct alignas(16) TrianglePacket4
+{
+	float v0[3][4];
+	float e1[3][4];
+	float e2[3][4];
+};
+
+// Closest hit among the triangles of a leaf, lane counts across all of its packets.
+struct PacketHit
+{
+	int lane = -1;
+	float t = BIGFLOAT;
+	float u = 0.0f;
+	float v = 0.0f;
+	bool front = true;
+};
+
+// Moller-Trumbore over packetCount packets, hits need tMin <= t < tMax.
+// The kernel is chosen from GetSIMDLevel, AVX2 takes two packets per step.
+bool IntersectTrianglePackets(const TrianglePacket4* packets, unsigned int packetCount, SIMDRay const& ray, int hitSide, float tMin, float tMax, PacketHit& hit);
+bool OccludedTrianglePackets(const TrianglePacket4* packets, unsigned int packetCount, SIMDRay const& ray, int hitSide, float tMin, float tMax);
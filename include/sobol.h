@@ -0,0 +1,101 @@
+#pragma once
+
+#include "rng.h"
+
+// Owen-scrambled Sobol, following Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020).
+// Every pair of dimensions uses the first two Sobol dimensions, which form a (0,2) sequence, with
+// its own scramble and its own shuffle of the sample index. That keeps the stratification of each
+// pair for any power of two prefix of samples, without direction number tables for high dimensions.
+namespace Sobol
+{
+	// second Sobol dimension, the first one is ReverseBits32(index)
+	inline unsigned int SampleDimension1(unsigned int index)
+	{
+		unsigned int result = 0;
+		for (unsigned int v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+		{
+			if (index & 1)
+			{
+				result ^= v;
+			}
+		}
+		return result;
+	}
+
+	// Laine-Karras hash, only ever flips a bit depending on the bits below it
+	inline unsigned int LaineKarrasPermutation(unsigned int x, unsigned int seed)
+	{
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	// Owen scrambling of a 0.32 fixed point value: each bit is flipped depending on the bits above it
+	inline unsigned int NestedUniformScramble(unsigned int x, unsigned int seed)
+	{
+		return ReverseBits32(LaineKarrasPermutation(ReverseBits32(x), seed));
+	}
+
+	inline float ToFloat(unsigned int x)
+	{
+		return (float)(x >> 8) * 0x1p-24f;
+	}
+}
+
+class SobolSampler : public SamplerContext
+{
+public:
+	explicit SobolSampler(uint64_t _seed = 0)
+		:seed(MixBits(_seed))
+	{
+	}
+
+	void StartSample(unsigned int _pixelIndex, unsigned int _sampleIndex) override
+	{
+		pixelSeed = MixBits(seed ^ _pixelIndex);
+		sampleIndex = _sampleIndex;
+		// dimension 0 is the pixel position
+		dimension = 1;
+	}
+
+	Vec2f GetPixel2D() override
+	{
+		return Sample2D(0);
+	}
+
+	float Next1D() override
+	{
+		uint64_t dimensionSeed = DimensionSeed(dimension++);
+		unsigned int index = Sobol::NestedUniformScramble(sampleIndex, (unsigned int)dimensionSeed);
+		return Sobol::ToFloat(Sobol::NestedUniformScramble(ReverseBits32(index), (unsigned int)(dimensionSeed >> 32)));
+	}
+
+	Vec2f Next2D() override
+	{
+		return Sample2D(dimension++);
+	}
+
+private:
+	uint64_t DimensionSeed(unsigned int d) const
+	{
+		return MixBits(pixelSeed + d * 0x9e3779b97f4a7c15ull);
+	}
+
+	Vec2f Sample2D(unsigned int d) const
+	{
+		uint64_t dimensionSeed = DimensionSeed(d);
+		// shuffling the index decorrelates neighbouring pixels and the dimensions of one path
+		unsigned int index = Sobol::NestedUniformScramble(sampleIndex, (unsigned int)dimensionSeed);
+		unsigned int x = Sobol::NestedUniformScramble(ReverseBits32(index), (unsigned int)(dimensionSeed >> 32));
+		unsigned int y = Sobol::NestedUniformScramble(Sobol::SampleDimension1(index), (unsigned int)MixBits(dimensionSeed));
+		return Vec2f(Sobol::ToFloat(x), Sobol::ToFloat(y));
+	}
+
+	uint64_t seed;
+	uint64_t pixelSeed = 0;
+	unsigned int sampleIndex = 0;
+	unsigned int dimension = 0;
+};
@@ -30,7 +30,7 @@ public:
 	void SetNormalTexture(TextureMap* map) { normal = map; }
 	void SetAOTexture(TextureMap* map) { ao = map; }
 
-	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability)
+	virtual void Sample(const HitInfo& hInfo, Vec3f& wi, const Vec3f& wo, float& probability, SamplerContext& sampler)
 	{
 		float roughnessValue = roughness.Sample(hInfo.uvw, hInfo.duvw).r;
 		Vec3f N = hInfo.N;
@@ -46,7 +46,7 @@ public:
 		Vec3f b1, b2;
 		BranchlessONB(brdfN, b1, b2);
 
-		Vec3f sampleDir = ImportanceSampleGGX(roughnessValue, probability);
+		Vec3f sampleDir = ImportanceSampleGGX(roughnessValue, probability, sampler.Next2D());
 		sampleDir = brdfN * sampleDir.z + b1 * sampleDir.x + b2 * sampleDir.y;
 		sampleDir.Normalize();
 
@@ -102,6 +102,11 @@ public:
 		return brdf.BRDF(wi, wo, N, albedoColor, roughnessValue, metalnessValue);
 	}
 
+	virtual Color GetAlbedo(const HitInfo& hInfo)
+	{
+		return albedo.SampleSrgb(hInfo.uvw, hInfo.duvw);
+	}
+
 private:
 	BrdfCookTorrance brdf;
 
@@ -24,6 +24,7 @@ public:
     TextureFile() : width(0), height(0) {}
     bool Load();
     virtual Color Sample(Vec3f const &uvw) const;
+    virtual bool GetResolution(int &w, int &h) const { w = width; h = height; return width > 0 && height > 0; }
 private:
 
     std::vector<Color24> data8bit;
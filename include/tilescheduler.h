@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+struct Tile
+{
+	unsigned int x0 = 0;
+	unsigned int y0 = 0;
+	// exclusive
+	unsigned int x1 = 0;
+	unsigned int y1 = 0;
+};
+
+// Hands out square tiles of the image pass by pass. At the start of a pass the tiles, in Morton order,
+// are split into one contiguous run per worker, so a worker walks a compact region of the image.
+// A worker whose queue runs dry steals from the far end of another queue. Passes are separated by
+// a barrier, so a pixel is never rendered by two workers at once. Tiles marked inactive between
+// passes, e.g. because they converged, are left out of the following passes.
+class TileScheduler
+{
+public:
+	void Init(unsigned int width, unsigned int height, unsigned int tileSize, unsigned int workerCount);
+
+	// false once no tile of the current pass is left anywhere
+	bool NextTile(unsigned int worker, Tile& tile);
+
+	// Waits for every worker to finish the pass. The last one to arrive calls stop(completedPassCount)
+	// and, unless it returns true, deals out the next pass. Returns false when rendering stops.
+	// stop runs while every other worker waits, so it may call SetTileActive.
+	template <typename Stop>
+	bool EndPass(Stop&& stop)
+	{
+		std::unique_lock<std::mutex> lock(passMutex);
+		unsigned int generation = passGeneration;
+
+		if (++arrivedCount == workerCount)
+		{
+			passCount++;
+			stopped = stop(passCount);
+			if (!stopped)
+			{
+				DealPass();
+			}
+
+			arrivedCount = 0;
+			passGeneration++;
+			passDone.notify_all();
+		}
+		else
+		{
+			passDone.wait(lock, [&]() { return passGeneration != generation; });
+		}
+
+		return !stopped;
+	}
+
+	unsigned int GetPassCount() const
+	{
+		return passCount;
+	}
+
+	unsigned int GetTileCount() const
+	{
+		return (unsigned int)tiles.size();
+	}
+
+	const Tile& GetTile(unsigned int index) const
+	{
+		return tiles[index];
+	}
+
+	// only between passes, see EndPass
+	void SetTileActive(unsigned int index, bool active)
+	{
+		tileActive[index] = active;
+	}
+
+private:
+	struct alignas(64) WorkerQueue
+	{
+		std::mutex mtx;
+		std::deque<unsigned int> tiles;
+	};
+
+	void DealPass();
+
+	std::vector<Tile> tiles;
+	std::vector<bool> tileActive;
+	std::unique_ptr<WorkerQueue[]> queues;
+	unsigned int workerCount = 0;
+
+	std::mutex passMutex;
+	std::condition_variable passDone;
+	unsigned int arrivedCount = 0;
+	unsigned int passGeneration = 0;
+	unsigned int passCount = 0;
+	bool stopped = false;
+};
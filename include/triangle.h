@@ -0,0 +1,92 @@
+#pragma once
+
+#include <float.h>
+#include "cyVector.h"
+#include "constants.h"
+#include "ray.h"
+
+using namespace cy;
+
+// Triangle edges relative to the first vertex, computed once after the BVH is built and stored in
+// leaf order next to it, so the intersection kernel reads one contiguous record per test.
+struct PrecomputedTriangle
+{
+	Vec3f v0;
+	Vec3f e1;
+	Vec3f e2;
+
+	void Set(Vec3f const& _v0, Vec3f const& v1, Vec3f const& v2)
+	{
+		v0 = _v0;
+		e1 = v1 - _v0;
+		e2 = v2 - _v0;
+	}
+
+	// Moller-Trumbore. u and v are the barycentric weights of the second and third vertex.
+	// Front side is where the ray goes against e1 x e2, same convention as the old plane based tests.
+	bool Intersect(Ray const& ray, int hitSide, float tMax, float& t, float& u, float& v, bool& front) const
+	{
+		Vec3f pvec = ray.dir.Cross(e2);
+		float det = e1.Dot(pvec);
+
+		if (fabsf(det) <= FLT_EPSILON)
+		{
+			return false;
+		}
+
+		front = det > 0.0f;
+		if ((front && !(hitSide & HIT_FRONT)) || (!front && !(hitSide & HIT_BACK)))
+		{
+			return false;
+		}
+
+		float invDet = 1.0f / det;
+		Vec3f tvec = ray.p - v0;
+		u = tvec.Dot(pvec) * invDet;
+		if (u < 0.0f || u > 1.0f)
+		{
+			return false;
+		}
+
+		Vec3f qvec = tvec.Cross(e1);
+		v = ray.dir.Dot(qvec) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+
+		t = e2.Dot(qvec) * invDet;
+		return t >= 0.0f && t < tMax;
+	}
+
+	// Barycentrics of the point where the ray crosses the triangle's plane, without the inside test.
+	// Used for ray differentials, which may land outside the triangle.
+	bool PlaneBarycentric(Ray const& ray, float& u, float& v) const
+	{
+		Vec3f pvec = ray.dir.Cross(e2);
+		float det = e1.Dot(pvec);
+
+		if (fabsf(det) <= FLT_EPSILON)
+		{
+			return false;
+		}
+
+		float invDet = 1.0f / det;
+		Vec3f tvec = ray.p - v0;
+		u = tvec.Dot(pvec) * invDet;
+		v = ray.dir.Dot(tvec.Cross(e1)) * invDet;
+		return true;
+	}
+};
+
+// closest triangle found during a traversal, surface attributes are interpolated once from it afterwards
+struct TriangleHit
+{
+	// position in the BVH leaf order, and the face it came from
+	unsigned int slot = 0;
+	unsigned int faceId = 0;
+	float t = BIGFLOAT;
+	float u = 0.0f;
+	float v = 0.0f;
+	bool front = true;
+};
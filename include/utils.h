@@ -4,16 +4,22 @@
 #include "cyVector.h"
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 using namespace cy;
 
 #define RANDOM_THRESHOLD 0.05f 
 
+// [0, 1) from a generator private to the calling thread, for code outside the per sample path.
+// Rendering draws from its SamplerContext instead, see rng.h.
+float RandomFloat();
+
 Vec3f RandomInUnitSphere();
 
 Vec2f NonUniformRandomPointInCircle(float radius);
 
 Vec2f RandomPointInCircle(float radius);
+Vec2f RandomPointInCircle(float radius, Vec2f u);
 
 void BranchlessONB(const Vec3f& n, Vec3f& b1, Vec3f& b2);
 
@@ -23,7 +29,7 @@ Vec3f UniformRandomPointOnHemiSphere();
 
 Vec3f CosineWeightedRandomPointOnHemiSphere();
 
-Vec3f ImportanceSampleGGX(float roughness, float& probability);
+Vec3f ImportanceSampleGGX(float roughness, float& probability, Vec2f u);
 
 int MIS2(float p1, float p2);
 int MIS3(float p1, float p2, float p3);
@@ -31,26 +37,22 @@ int MIS3(float p1, float p2, float p3);
 float LightFallOffFactor(const Vec3f& p1, const Vec3f& p2);
 float LightFallOffFactor(float distance);
 
-Vec2f UniformSampleTriangle();
+Vec2f UniformSampleTriangle(Vec2f u);
 
-int RandomIndexElementInList(int size);
+int RandomIndexElementInList(int size, float u);
 
 float RandomRange(float left, float right);
 
-class CDF 
-{
-public:
-	CDF();
-
-	void Init();
+// FNV-1a 64, enough to tell inputs apart for cache keys and checkpoint identities
+const uint64_t FNVOffsetBasis = 14695981039346656037ull;
+const uint64_t FNVPrime = 1099511628211ull;
 
-	// rand from 0 to tatal, return the correspond id
-	int Sample() const;
+void HashBytes(uint64_t& hash, const void* data, size_t size);
 
-	void Add(float val);
-
-	float total;
-	std::vector<float> cd;
-};
+template <typename T>
+void HashValue(uint64_t& hash, const T& value)
+{
+	HashBytes(hash, &value, sizeof(T));
+}
 
 Vec3f ParseVec3f(std::string& str);
\ No newline at end of file
@@ -1,3 +1,420 @@
 #include "bvh.h"
+#include <algorithm>
+#include <future>
+#include <thread>
 
+BVHNode* BinnedSAHBuilder::Build(const std::vector<BVHBound>& primitiveBounds)
+{
+	bounds = primitiveBounds;
 
+	unsigned int count = (unsigned int)bounds.size();
+	centroids.resize(count);
+	indices.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		centroids[i] = bounds[i].GetCenter();
+		indices[i] = i;
+	}
+
+	// enough forks to give every hardware thread a subtree, each one splits its range in two
+	int forkDepth = 0;
+	for (unsigned int threads = 1; threads < std::thread::hardware_concurrency(); threads *= 2)
+	{
+		forkDepth++;
+	}
+
+	BVHNode* root = new BVHNode();
+	BuildNode(root, 0, count, 0, forkDepth);
+
+	bounds.clear();
+	centroids.clear();
+	indices.clear();
+
+	return root;
+}
+
+void BinnedSAHBuilder::MakeLeaf(BVHNode* node, unsigned int begin, unsigned int end)
+{
+	node->faceList.assign(indices.begin() + begin, indices.begin() + end);
+}
+
+void BinnedSAHBuilder::BuildNode(BVHNode* node, unsigned int begin, unsigned int end, int depth, int forkDepth)
+{
+	unsigned int count = end - begin;
+
+	BVHBound centroidBound;
+	for (unsigned int i = begin; i < end; i++)
+	{
+		node->bound.UpdateByBound(bounds[indices[i]]);
+		centroidBound.UpdateByPoint(centroids[indices[i]]);
+	}
+
+	if (count <= 1)
+	{
+		MakeLeaf(node, begin, end);
+		return;
+	}
+
+	// SAH can keep peeling a few primitives off one side, deep down only halve the range so every
+	// leaf stays within MaxBVHDepth, a median split needs log2(count) more levels at most
+	int medianLevels = 0;
+	while ((1ull << medianLevels) < count)
+	{
+		medianLevels++;
+	}
+
+	if (depth >= MedianSplitDepth || depth + medianLevels >= MaxBVHDepth)
+	{
+		if (count <= (unsigned int)settings.maxLeafSize)
+		{
+			MakeLeaf(node, begin, end);
+			return;
+		}
+
+		Vec3f extent = centroidBound.GetMax() - centroidBound.GetMin();
+		int axis = extent.MaxIndex();
+		unsigned int middle = begin + count / 2;
+		std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](unsigned int a, unsigned int b)
+		{
+			return centroids[a][axis] < centroids[b][axis];
+		});
+
+		BuildChildren(node, begin, middle, end, depth, forkDepth);
+		return;
+	}
+
+	// same cost model as the scan line split, leaf costs one unit per face,
+	// internal node costs one traversal step plus its children weighted by hit probability
+	float parentAsLeafTime = count * 1.0f;
+	float parentAsInternalTime = BIGFLOAT;
+	float totalSurfaceArea = node->bound.SurfaceArea();
+
+	int binCount = settings.binCount < 2 ? 2 : settings.binCount;
+	std::vector<Bin> bins(binCount);
+	std::vector<float> rightArea(binCount);
+	std::vector<unsigned int> rightCount(binCount);
+
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float axisMin = centroidBound.data[axis];
+		float extent = centroidBound.data[axis + 3] - axisMin;
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		for (int b = 0; b < binCount; b++)
+		{
+			bins[b] = Bin();
+		}
+
+		float scale = binCount / extent;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			unsigned int primitive = indices[i];
+			int b = (int)((centroids[primitive][axis] - axisMin) * scale);
+			if (b >= binCount)
+			{
+				b = binCount - 1;
+			}
+			bins[b].count++;
+			bins[b].bound.UpdateByBound(bounds[primitive]);
+		}
+
+		// sweep from the right to get the right side of every split plane
+		BVHBound accumulated;
+		unsigned int accumulatedCount = 0;
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			accumulated.UpdateByBound(bins[b].bound);
+			accumulatedCount += bins[b].count;
+			rightArea[b] = accumulated.SurfaceArea();
+			rightCount[b] = accumulatedCount;
+		}
+
+		accumulated = BVHBound();
+		accumulatedCount = 0;
+		for (int b = 0; b < binCount - 1; b++)
+		{
+			accumulated.UpdateByBound(bins[b].bound);
+			accumulatedCount += bins[b].count;
+
+			if (accumulatedCount == 0 || rightCount[b + 1] == 0)
+			{
+				continue;
+			}
+
+			float pLeft = accumulated.SurfaceArea() / totalSurfaceArea;
+			float pRight = rightArea[b + 1] / totalSurfaceArea;
+			float currentInternalTime = 1.0f + pLeft * accumulatedCount + pRight * rightCount[b + 1];
+
+			if (currentInternalTime < parentAsInternalTime)
+			{
+				parentAsInternalTime = currentInternalTime;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	bool forceSplit = count > (unsigned int)settings.maxLeafSize;
+
+	if (parentAsLeafTime <= parentAsInternalTime && !forceSplit)
+	{
+		MakeLeaf(node, begin, end);
+		return;
+	}
+
+	unsigned int middle;
+	if (bestAxis < 0)
+	{
+		// every centroid is in the same spot, any split is as good as another
+		middle = begin + count / 2;
+	}
+	else
+	{
+		float axisMin = centroidBound.data[bestAxis];
+		float scale = binCount / (centroidBound.data[bestAxis + 3] - axisMin);
+		auto it = std::partition(indices.begin() + begin, indices.begin() + end, [&](unsigned int primitive)
+		{
+			int b = (int)((centroids[primitive][bestAxis] - axisMin) * scale);
+			if (b >= binCount)
+			{
+				b = binCount - 1;
+			}
+			return b <= bestSplit;
+		});
+		middle = (unsigned int)(it - indices.begin());
+	}
+
+	BuildChildren(node, begin, middle, end, depth, forkDepth);
+}
+
+void BinnedSAHBuilder::BuildChildren(BVHNode* node, unsigned int begin, unsigned int middle, unsigned int end, int depth, int forkDepth)
+{
+	assert(middle > begin && middle < end);
+
+	node->left = new BVHNode();
+	node->right = new BVHNode();
+
+	// the split only depends on the range contents, so forking leaves the tree identical
+	if (forkDepth > 0 && end - begin >= settings.parallelSplitSize)
+	{
+		std::future<void> left = std::async(std::launch::async, [this, node, begin, middle, depth, forkDepth]()
+		{
+			BuildNode(node->left, begin, middle, depth + 1, forkDepth - 1);
+		});
+		BuildNode(node->right, middle, end, depth + 1, forkDepth - 1);
+		left.get();
+	}
+	else
+	{
+		BuildNode(node->left, begin, middle, depth + 1, forkDepth);
+		BuildNode(node->right, middle, end, depth + 1, forkDepth);
+	}
+}
+
+void DeleteBVHTree(BVHNode* node)
+{
+	if (node == nullptr)
+	{
+		return;
+	}
+
+	DeleteBVHTree(node->left);
+	DeleteBVHTree(node->right);
+	delete node;
+}
+
+void LinearBVH::Flatten(BVHNode* root)
+{
+	nodes.clear();
+	primitives.clear();
+
+	if (root == nullptr || (root->IsLeaf() && root->faceList.empty()))
+	{
+		return;
+	}
+
+	FlattenNode(root, 0);
+}
+
+void LinearBVH::GatherFaces(BVHNode* node, std::vector<unsigned int>& faces)
+{
+	if (node->IsLeaf())
+	{
+		faces.insert(faces.end(), node->faceList.begin(), node->faceList.end());
+		return;
+	}
+
+	GatherFaces(node->left, faces);
+	GatherFaces(node->right, faces);
+}
+
+unsigned int LinearBVH::FlattenNode(BVHNode* node, int depth)
+{
+	assert(depth <= MaxBVHDepth);
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(LinearBVHNode());
+
+	for (int i = 0; i < 6; i++)
+	{
+		nodes[index].bound[i] = node->bound.data[i];
+	}
+
+	if (node->IsLeaf() || depth >= MaxBVHDepth)
+	{
+		// the binned builder never gets here with an internal node, the scan line one has no depth
+		// limit, so whatever it built past the traversal stack becomes one leaf
+		std::vector<unsigned int> faces;
+		GatherFaces(node, faces);
+		assert(faces.size() <= MaxLeafPrimitives);
+
+		nodes[index].isLeaf = 1;
+		nodes[index].axis = 0;
+		nodes[index].offset = (unsigned int)primitives.size();
+		nodes[index].primitiveCount = (unsigned int)faces.size();
+		primitives.insert(primitives.end(), faces.begin(), faces.end());
+	}
+	else
+	{
+		// the builders don't keep the split plane, the axis the children are furthest apart on is as good
+		Vec3f childOffset = node->right->bound.GetCenter() - node->left->bound.GetCenter();
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (fabsf(childOffset[i]) > fabsf(childOffset[axis]))
+			{
+				axis = i;
+			}
+		}
+
+		nodes[index].isLeaf = 0;
+		nodes[index].primitiveCount = 0;
+		nodes[index].axis = (unsigned int)axis;
+
+		// the first child is visited first for rays going along the axis, so it has to be the low side
+		BVHNode* first = node->left;
+		BVHNode* second = node->right;
+		if (childOffset[axis] < 0.0f)
+		{
+			std::swap(first, second);
+		}
+
+		FlattenNode(first, depth + 1);
+		nodes[index].offset = FlattenNode(second, depth + 1);
+	}
+
+	return index;
+}
+
+void WideBVH::Collapse(const LinearBVH& linear)
+{
+	nodes.clear();
+
+	if (linear.nodes.empty())
+	{
+		return;
+	}
+
+	CollapseNode(linear, 0);
+}
+
+unsigned int WideBVH::CollapseNode(const LinearBVH& linear, unsigned int linearIndex)
+{
+	auto surfaceArea = [&](unsigned int index)
+	{
+		return BVHBound(linear.nodes[index].bound).SurfaceArea();
+	};
+
+	// open up the largest internal child until there are four, a leaf root becomes a single lane
+	unsigned int children[4];
+	int childCount = 0;
+	const LinearBVHNode& linearNode = linear.nodes[linearIndex];
+	if (linearNode.isLeaf)
+	{
+		children[childCount++] = linearIndex;
+	}
+	else
+	{
+		children[childCount++] = linearIndex + 1;
+		children[childCount++] = linearNode.offset;
+	}
+
+	while (childCount < 4)
+	{
+		int largest = -1;
+		for (int i = 0; i < childCount; i++)
+		{
+			if (!linear.nodes[children[i]].isLeaf && (largest < 0 || surfaceArea(children[i]) > surfaceArea(children[largest])))
+			{
+				largest = i;
+			}
+		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		unsigned int opened = children[largest];
+		children[largest] = opened + 1;
+		children[childCount++] = linear.nodes[opened].offset;
+	}
+
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(WideBVHNode());
+
+	WideBVHNode node = {};
+	node.childCount = (unsigned char)childCount;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.bounds[axis][lane] = lane < childCount ? linear.nodes[children[lane]].bound[axis] : BIGFLOAT;
+			node.bounds[axis + 3][lane] = lane < childCount ? linear.nodes[children[lane]].bound[axis + 3] : -BIGFLOAT;
+		}
+	}
+
+	// sort the lanes along the diagonal of each octant, that is the order a ray going that way meets them
+	for (int octant = 0; octant < 8; octant++)
+	{
+		int order[4] = { 0, 1, 2, 3 };
+		float distance[4] = {};
+		for (int lane = 0; lane < childCount; lane++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float center = node.bounds[axis][lane] + node.bounds[axis + 3][lane];
+				distance[lane] += (octant & (1 << axis)) ? -center : center;
+			}
+		}
+		std::stable_sort(order, order + childCount, [&](int a, int b) { return distance[a] < distance[b]; });
+
+		node.octantOrder[octant] = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			node.octantOrder[octant] |= (unsigned char)(order[i] << (2 * i));
+		}
+	}
+
+	for (int lane = 0; lane < childCount; lane++)
+	{
+		if (linear.nodes[children[lane]].isLeaf)
+		{
+			node.leafMask |= 1 << lane;
+			node.child[lane] = children[lane];
+		}
+		else
+		{
+			node.child[lane] = CollapseNode(linear, children[lane]);
+		}
+	}
+
+	// children were appended after this node, the vector may have grown meanwhile
+	nodes[index] = node;
+	return index;
+}
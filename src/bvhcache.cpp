@@ -0,0 +1,358 @@
+#include "bvhcache.h"
+#include "mesh.h"
+#include "string_utils.h"
+#include "utils.h"
+#include <fstream>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	const char CacheDirectory[] = "bvhcache";
+	const char Magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 'A', 'C' };
+	const uint64_t SectionAlignment = 64;
+
+	struct CacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		// guards against reading a file written with a different node layout
+		uint32_t linearNodeSize;
+		uint32_t wideNodeSize;
+		uint32_t faceCount;
+		uint64_t hash;
+		uint64_t linearNodeCount;
+		uint64_t primitiveCount;
+		uint64_t wideNodeCount;
+		uint64_t linearNodeOffset;
+		uint64_t primitiveOffset;
+		uint64_t wideNodeOffset;
+	};
+
+	uint64_t AlignSection(uint64_t offset)
+	{
+		return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+	}
+
+	void MakeCacheDirectory()
+	{
+#ifdef _WIN32
+		_mkdir(CacheDirectory);
+#else
+		mkdir(CacheDirectory, 0755);
+#endif
+	}
+
+	// the section has to lie inside the file before anything is allocated for it
+	template <typename T>
+	bool ReadSection(std::ifstream& file, uint64_t fileSize, uint64_t offset, uint64_t count, std::vector<T>& data)
+	{
+		if (offset > fileSize || count > (fileSize - offset) / sizeof(T))
+		{
+			return false;
+		}
+
+		data.resize((size_t)count);
+		if (count == 0)
+		{
+			return true;
+		}
+		file.seekg((std::streamoff)offset);
+		file.read((char*)data.data(), (std::streamsize)(count * sizeof(T)));
+		return (bool)file;
+	}
+
+	// Walks the node graph the way traversal would: every node reached exactly once, children and
+	// leaf ranges inside the arrays and no leaf deeper than the traversal stack allows.
+	bool ValidLinearNodes(const LinearBVH& linear)
+	{
+		const std::vector<LinearBVHNode>& nodes = linear.nodes;
+		if (nodes.empty())
+		{
+			return true;
+		}
+
+		std::vector<bool> visited(nodes.size(), false);
+		std::vector<std::pair<uint64_t, int>> stack;
+		stack.push_back(std::make_pair(0ull, 0));
+		size_t visitedCount = 0;
+
+		while (!stack.empty())
+		{
+			uint64_t current = stack.back().first;
+			int depth = stack.back().second;
+			stack.pop_back();
+
+			if (visited[(size_t)current])
+			{
+				return false;
+			}
+			visited[(size_t)current] = true;
+			visitedCount++;
+
+			const LinearBVHNode& node = nodes[(size_t)current];
+			if (node.isLeaf)
+			{
+				if ((uint64_t)node.offset + node.primitiveCount > linear.primitives.size())
+				{
+					return false;
+				}
+				continue;
+			}
+
+			if (depth >= MaxBVHDepth
+				|| current + 1 >= nodes.size()
+				|| node.offset < 1
+				|| node.offset >= nodes.size())
+			{
+				return false;
+			}
+
+			stack.push_back(std::make_pair(current + 1, depth + 1));
+			stack.push_back(std::make_pair((uint64_t)node.offset, depth + 1));
+		}
+
+		return visitedCount == nodes.size();
+	}
+
+	// Same for the wide nodes, leaf lanes have to name leaves of linear.
+	bool ValidWideNodes(const WideBVH& wide, const LinearBVH& linear)
+	{
+		const std::vector<WideBVHNode>& nodes = wide.nodes;
+		if (nodes.empty())
+		{
+			return true;
+		}
+
+		std::vector<bool> visited(nodes.size(), false);
+		std::vector<std::pair<unsigned int, int>> stack;
+		stack.push_back(std::make_pair(0u, 0));
+		size_t visitedCount = 0;
+
+		while (!stack.empty())
+		{
+			unsigned int current = stack.back().first;
+			int depth = stack.back().second;
+			stack.pop_back();
+
+			if (visited[current] || depth >= MaxBVHDepth)
+			{
+				return false;
+			}
+			visited[current] = true;
+			visitedCount++;
+
+			const WideBVHNode& node = nodes[current];
+			if (node.childCount > 4)
+			{
+				return false;
+			}
+
+			// traversal only pushes the lanes named by the octant order
+			for (int octant = 0; octant < 8; octant++)
+			{
+				for (int i = 0; i < node.childCount; i++)
+				{
+					if (((node.octantOrder[octant] >> (2 * i)) & 3) >= node.childCount)
+					{
+						return false;
+					}
+				}
+			}
+
+			for (int lane = 0; lane < node.childCount; lane++)
+			{
+				unsigned int child = node.child[lane];
+				if ((node.leafMask >> lane) & 1)
+				{
+					if (child >= linear.nodes.size() || !linear.nodes[child].isLeaf)
+					{
+						return false;
+					}
+				}
+				else
+				{
+					if (child >= nodes.size())
+					{
+						return false;
+					}
+					stack.push_back(std::make_pair(child, depth + 1));
+				}
+			}
+		}
+
+		return visitedCount == nodes.size();
+	}
+
+	template <typename T>
+	void WriteSection(std::ofstream& file, uint64_t offset, const std::vector<T>& data)
+	{
+		if (data.empty())
+		{
+			return;
+		}
+		file.seekp((std::streamoff)offset);
+		file.write((const char*)data.data(), (std::streamsize)(data.size() * sizeof(T)));
+	}
+}
+
+uint64_t BVHCache::HashMesh(const Mesh& mesh, const BVHBuildSettings& settings)
+{
+	uint64_t hash = FNVOffsetBasis;
+
+	HashValue(hash, Version);
+	HashValue(hash, (int)settings.method);
+	HashValue(hash, (int)settings.layout);
+	HashValue(hash, settings.binCount);
+	HashValue(hash, settings.maxLeafSize);
+
+	uint64_t vertexCount = mesh.vertices.size();
+	HashValue(hash, vertexCount);
+	if (vertexCount > 0)
+	{
+		HashBytes(hash, mesh.vertices.data(), mesh.vertices.size() * sizeof(glm::vec3));
+	}
+
+	uint64_t faceCount = mesh.faces.size();
+	HashValue(hash, faceCount);
+	for (const Face& face : mesh.faces)
+	{
+		// the fourth index is the face id, implied by the position
+		HashBytes(hash, face.indices.data(), 3 * sizeof(unsigned int));
+	}
+
+	return hash;
+}
+
+std::string BVHCache::GetPath(uint64_t hash)
+{
+	return StringUtils::Format("%s/%016llx.bvh", CacheDirectory, (unsigned long long)hash);
+}
+
+MeshBVHNew* BVHCache::Load(uint64_t hash, Mesh* mesh)
+{
+	std::ifstream file(GetPath(hash), std::ios::binary);
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	CacheHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file
+		|| memcmp(header.magic, Magic, sizeof(Magic)) != 0
+		|| header.version != Version
+		|| header.linearNodeSize != sizeof(LinearBVHNode)
+		|| header.wideNodeSize != sizeof(WideBVHNode)
+		|| header.hash != hash
+		|| header.faceCount != mesh->faces.size()
+		|| header.primitiveCount != mesh->faces.size())
+	{
+		spdlog::warn("ignoring stale bvh cache entry {}", GetPath(hash));
+		return nullptr;
+	}
+
+	// a binary tree over n primitives has fewer than 2n nodes, every wide node replaces an internal one
+	if (header.linearNodeCount > 2 * (uint64_t)header.faceCount
+		|| header.wideNodeCount > header.linearNodeCount)
+	{
+		spdlog::warn("corrupted bvh cache entry {}", GetPath(hash));
+		return nullptr;
+	}
+
+	LinearBVH linear;
+	WideBVH wide;
+	if (!ReadSection(file, fileSize, header.linearNodeOffset, header.linearNodeCount, linear.nodes)
+		|| !ReadSection(file, fileSize, header.primitiveOffset, header.primitiveCount, linear.primitives)
+		|| !ReadSection(file, fileSize, header.wideNodeOffset, header.wideNodeCount, wide.nodes))
+	{
+		spdlog::warn("truncated bvh cache entry {}", GetPath(hash));
+		return nullptr;
+	}
+
+	// a corrupted file must not send the traversal out of bounds
+	bool valid = !(linear.nodes.empty() && !mesh->faces.empty())
+		&& ValidLinearNodes(linear)
+		&& ValidWideNodes(wide, linear);
+	for (unsigned int primitive : linear.primitives)
+	{
+		if (primitive >= mesh->faces.size())
+		{
+			valid = false;
+			break;
+		}
+	}
+
+	if (!valid)
+	{
+		spdlog::warn("corrupted bvh cache entry {}", GetPath(hash));
+		return nullptr;
+	}
+
+	return new MeshBVHNew(mesh, std::move(linear), std::move(wide));
+}
+
+bool BVHCache::Save(uint64_t hash, const MeshBVHNew& bvh)
+{
+	const LinearBVH& linear = bvh.GetLinearBVH();
+	const WideBVH& wide = bvh.GetWideBVH();
+
+	CacheHeader header = {};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.linearNodeSize = sizeof(LinearBVHNode);
+	header.wideNodeSize = sizeof(WideBVHNode);
+	header.faceCount = (uint32_t)linear.primitives.size();
+	header.hash = hash;
+	header.linearNodeCount = linear.nodes.size();
+	header.primitiveCount = linear.primitives.size();
+	header.wideNodeCount = wide.nodes.size();
+	header.linearNodeOffset = AlignSection(sizeof(CacheHeader));
+	header.primitiveOffset = AlignSection(header.linearNodeOffset + header.linearNodeCount * sizeof(LinearBVHNode));
+	header.wideNodeOffset = AlignSection(header.primitiveOffset + header.primitiveCount * sizeof(unsigned int));
+
+	MakeCacheDirectory();
+
+	std::string path = GetPath(hash);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			spdlog::warn("can not write bvh cache entry {}", path);
+			return false;
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		WriteSection(file, header.linearNodeOffset, linear.nodes);
+		WriteSection(file, header.primitiveOffset, linear.primitives);
+		WriteSection(file, header.wideNodeOffset, wide.nodes);
+
+		if (!file)
+		{
+			spdlog::warn("can not write bvh cache entry {}", path);
+			file.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// rename does not replace an existing file everywhere, another process may have written it meanwhile
+	remove(path.c_str());
+	if (rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,176 @@
+#include "denoiser.h"
+#include "film.h"
+#include <thread>
+#include <atomic>
+
+namespace
+{
+	const float Kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	const float AlbedoEpsilon = 0.001f;
+
+	struct GuidePixel
+	{
+		Vec3f normal;
+		float depth;
+		Color albedo;
+	};
+
+	float Luminance(const Color& color)
+	{
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
+
+	// rows are handed out one at a time, an iteration is a few milliseconds of work
+	template <typename Func>
+	void ParallelRows(unsigned int height, unsigned int threadCount, const Func& func)
+	{
+		std::atomic<unsigned int> nextRow(0);
+		auto worker = [&]()
+		{
+			for (unsigned int y = nextRow.fetch_add(1); y < height; y = nextRow.fetch_add(1))
+			{
+				func(y);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < threadCount; i++)
+		{
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+}
+
+bool ATrousDenoiser::Denoise(const Film& film, std::vector<Color>& output) const
+{
+	if (!film.HasLayer(AOVType::Albedo) || !film.HasLayer(AOVType::Normal) || !film.HasLayer(AOVType::Depth))
+	{
+		return false;
+	}
+
+	const unsigned int width = film.GetWidth();
+	const unsigned int height = film.GetHeight();
+	const size_t size = (size_t)width * height;
+
+	unsigned int threads = threadCount;
+	if (threads == 0)
+	{
+		threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+	}
+
+	std::vector<GuidePixel> guide(size);
+	std::vector<Color> color(size);
+	std::vector<float> variance(size);
+	ParallelRows(height, threads, [&](unsigned int y)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			size_t i = x + (size_t)y * width;
+			float values[3];
+			GuidePixel& pixel = guide[i];
+
+			film.GetLayerPixel(AOVType::Albedo, x, y, values);
+			pixel.albedo = Color(values[0], values[1], values[2]);
+			film.GetLayerPixel(AOVType::Normal, x, y, values);
+			pixel.normal = Vec3f(values[0], values[1], values[2]);
+			float length = pixel.normal.Length();
+			pixel.normal = length > 0.0f ? pixel.normal / length : pixel.normal;
+			film.GetLayerPixel(AOVType::Depth, x, y, &pixel.depth);
+
+			// filter the lighting, not the texture
+			Color beauty = film.GetColor(x, y);
+			color[i] = Color(
+				beauty.r / (pixel.albedo.r + AlbedoEpsilon),
+				beauty.g / (pixel.albedo.g + AlbedoEpsilon),
+				beauty.b / (pixel.albedo.b + AlbedoEpsilon));
+			// the variance is of the beauty's luminance, bring it to the demodulated scale
+			float albedoLuminance = Luminance(pixel.albedo) + AlbedoEpsilon;
+			variance[i] = film.GetVariance(x, y) / (albedoLuminance * albedoLuminance);
+		}
+	});
+
+	std::vector<Color> nextColor(size);
+	std::vector<float> nextVariance(size);
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		const int step = 1 << iteration;
+		ParallelRows(height, threads, [&](unsigned int y)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				size_t center = x + (size_t)y * width;
+				const GuidePixel& p = guide[center];
+				float luminance = Luminance(color[center]);
+				float luminanceScale = colorSigma * sqrtf(variance[center] > 0.0f ? variance[center] : 0.0f) + 1e-4f;
+				float depthScale = depthSigma * (float)step * (p.depth < BIGFLOAT ? p.depth : 1.0f) + 1e-4f;
+
+				Color sum = Color::Black();
+				float varianceSum = 0.0f;
+				float weightSum = 0.0f;
+				for (int dy = -2; dy <= 2; dy++)
+				{
+					int qy = (int)y + dy * step;
+					if (qy < 0 || qy >= (int)height)
+					{
+						continue;
+					}
+					for (int dx = -2; dx <= 2; dx++)
+					{
+						int qx = (int)x + dx * step;
+						if (qx < 0 || qx >= (int)width)
+						{
+							continue;
+						}
+
+						size_t i = qx + (size_t)qy * width;
+						const GuidePixel& q = guide[i];
+
+						float normalDot = p.normal.Dot(q.normal);
+						float normalWeight = normalDot > 0.0f ? powf(normalDot, normalPower) : 0.0f;
+						// a camera ray that missed has neither normal nor depth
+						if (p.depth >= BIGFLOAT || q.depth >= BIGFLOAT)
+						{
+							normalWeight = (p.depth >= BIGFLOAT) == (q.depth >= BIGFLOAT) ? 1.0f : 0.0f;
+						}
+						float depthDifference = p.depth < BIGFLOAT && q.depth < BIGFLOAT ? fabsf(p.depth - q.depth) : 0.0f;
+						float weight = Kernel[dx + 2] * Kernel[dy + 2] * normalWeight
+							* expf(-depthDifference / depthScale - fabsf(luminance - Luminance(color[i])) / luminanceScale);
+
+						sum += color[i] * weight;
+						varianceSum += variance[i] * weight * weight;
+						weightSum += weight;
+					}
+				}
+
+				// the center tap always has weight, unless its own normal is degenerate
+				if (weightSum > 0.0f)
+				{
+					nextColor[center] = sum / weightSum;
+					nextVariance[center] = varianceSum / (weightSum * weightSum);
+				}
+				else
+				{
+					nextColor[center] = color[center];
+					nextVariance[center] = variance[center];
+				}
+			}
+		});
+		color.swap(nextColor);
+		variance.swap(nextVariance);
+	}
+
+	output.resize(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		output[i] = Color(
+			color[i].r * (guide[i].albedo.r + AlbedoEpsilon),
+			color[i].g * (guide[i].albedo.g + AlbedoEpsilon),
+			color[i].b * (guide[i].albedo.b + AlbedoEpsilon));
+	}
+	return true;
+}
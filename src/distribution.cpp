@@ -0,0 +1,285 @@
+#include "distribution.h"
+
+void Distribution1D::Clear()
+{
+	total = 0.0f;
+	probabilities.clear();
+	cdf.clear();
+	bins.clear();
+}
+
+void Distribution1D::Build(const std::vector<float>& weights)
+{
+	Clear();
+	unsigned int count = (unsigned int)weights.size();
+	if (count == 0)
+	{
+		return;
+	}
+
+	// sum in double, meshes with millions of tiny faces lose too much in float
+	double sum = 0.0;
+	for (float weight : weights)
+	{
+		sum += weight > 0.0f ? weight : 0.0f;
+	}
+	total = (float)sum;
+
+	probabilities.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float weight = weights[i] > 0.0f ? weights[i] : 0.0f;
+		probabilities[i] = sum > 0.0 ? (float)(weight / sum) : 1.0f / count;
+	}
+
+	cdf.resize(count + 1);
+	double running = 0.0;
+	cdf[0] = 0.0f;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		running += probabilities[i];
+		cdf[i + 1] = (float)running;
+	}
+	cdf[count] = 1.0f;
+
+	// Vose: pair every bin below the average with one above it, the large one fills up the rest
+	std::vector<double> scaled(count);
+	std::vector<int> small;
+	std::vector<int> large;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		scaled[i] = (double)probabilities[i] * count;
+		if (scaled[i] < 1.0)
+		{
+			small.push_back(i);
+		}
+		else
+		{
+			large.push_back(i);
+		}
+	}
+
+	bins.resize(count);
+	while (!small.empty() && !large.empty())
+	{
+		int less = small.back();
+		small.pop_back();
+		int more = large.back();
+		large.pop_back();
+
+		bins[less].threshold = (float)scaled[less];
+		bins[less].alias = more;
+
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0)
+		{
+			small.push_back(more);
+		}
+		else
+		{
+			large.push_back(more);
+		}
+	}
+
+	// whatever is left is 1 up to rounding
+	for (int i : large)
+	{
+		bins[i].threshold = 1.0f;
+		bins[i].alias = i;
+	}
+	for (int i : small)
+	{
+		bins[i].threshold = 1.0f;
+		bins[i].alias = i;
+	}
+}
+
+int Distribution1D::Sample(float u, float* pdf) const
+{
+	if (bins.empty())
+	{
+		if (pdf)
+		{
+			*pdf = 0.0f;
+		}
+		return 0;
+	}
+
+	// the integer part picks the bin, the fraction decides between the bin and its alias
+	unsigned int count = (unsigned int)bins.size();
+	float scaled = u * count;
+	unsigned int bin = (unsigned int)scaled;
+	bin = bin < count ? bin : count - 1;
+	float coin = scaled - bin;
+
+	int index = coin < bins[bin].threshold ? (int)bin : bins[bin].alias;
+	if (pdf)
+	{
+		*pdf = probabilities[index];
+	}
+	return index;
+}
+
+int Distribution1D::SampleInverse(float u, float* pdf, float* remapped) const
+{
+	if (probabilities.empty())
+	{
+		if (pdf)
+		{
+			*pdf = 0.0f;
+		}
+		return 0;
+	}
+
+	// last index with cdf[index] <= u, skipping items of zero weight
+	int low = 0;
+	int high = (int)probabilities.size() - 1;
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		if (cdf[middle] <= u)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+	int index = low;
+	while (probabilities[index] == 0.0f && index > 0)
+	{
+		index--;
+	}
+
+	if (pdf)
+	{
+		*pdf = probabilities[index];
+	}
+	if (remapped)
+	{
+		float r = (u - cdf[index]) / probabilities[index];
+		*remapped = r < 0.0f ? 0.0f : (r < 0x1.fffffep-1f ? r : 0x1.fffffep-1f);
+	}
+	return index;
+}
+
+int Distribution1D::SampleExcluding(float u, int excluded, float* pdf) const
+{
+	if (excluded < 0 || excluded >= (int)probabilities.size())
+	{
+		return Sample(u, pdf);
+	}
+
+	float remaining = 1.0f - probabilities[excluded];
+	if (remaining <= 0.0f)
+	{
+		if (pdf)
+		{
+			*pdf = 0.0f;
+		}
+		return -1;
+	}
+
+	// squeeze u into the cdf with the excluded item's interval cut out
+	float v = u * remaining;
+	if (v >= cdf[excluded])
+	{
+		v += probabilities[excluded];
+	}
+	v = v < 0x1.fffffep-1f ? v : 0x1.fffffep-1f;
+
+	int index = SampleInverse(v);
+	// rounding can leave v on the excluded interval's edge, take the closest item with weight
+	if (index == excluded)
+	{
+		int count = (int)probabilities.size();
+		index = -1;
+		for (int i = excluded + 1; i < count && index < 0; i++)
+		{
+			index = probabilities[i] > 0.0f ? i : -1;
+		}
+		for (int i = excluded - 1; i >= 0 && index < 0; i--)
+		{
+			index = probabilities[i] > 0.0f ? i : -1;
+		}
+		if (index < 0)
+		{
+			if (pdf)
+			{
+				*pdf = 0.0f;
+			}
+			return -1;
+		}
+	}
+
+	if (pdf)
+	{
+		*pdf = probabilities[index] / remaining;
+	}
+	return index;
+}
+
+void Distribution2D::Clear()
+{
+	width = 0;
+	height = 0;
+	marginal.Clear();
+	conditionals.clear();
+}
+
+void Distribution2D::Build(const std::vector<float>& weights, unsigned int _width, unsigned int _height)
+{
+	Clear();
+	if (_width == 0 || _height == 0 || weights.size() < (size_t)_width * _height)
+	{
+		return;
+	}
+
+	width = _width;
+	height = _height;
+	conditionals.resize(height);
+	std::vector<float> rowSums(height);
+	std::vector<float> row(width);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		row.assign(weights.begin() + (size_t)y * width, weights.begin() + (size_t)(y + 1) * width);
+		conditionals[y].Build(row);
+		rowSums[y] = conditionals[y].Total();
+	}
+	marginal.Build(rowSums);
+}
+
+Vec2f Distribution2D::Sample(Vec2f u, float& pdf) const
+{
+	pdf = 0.0f;
+	if (Empty())
+	{
+		return Vec2f(0.0f, 0.0f);
+	}
+
+	// the inverse cdf keeps the stratification of u, the offset inside the cell comes from the remapped u
+	float rowPdf;
+	float rowOffset;
+	int y = marginal.SampleInverse(u.y, &rowPdf, &rowOffset);
+	float columnPdf;
+	float columnOffset;
+	int x = conditionals[y].SampleInverse(u.x, &columnPdf, &columnOffset);
+
+	pdf = rowPdf * height * columnPdf * width;
+	return Vec2f((x + columnOffset) / width, (y + rowOffset) / height);
+}
+
+float Distribution2D::Pdf(Vec2f p) const
+{
+	if (Empty())
+	{
+		return 0.0f;
+	}
+
+	unsigned int x = p.x > 0.0f ? (unsigned int)(p.x * width) : 0;
+	unsigned int y = p.y > 0.0f ? (unsigned int)(p.y * height) : 0;
+	x = x < width ? x : width - 1;
+	y = y < height ? y : height - 1;
+	return marginal.Pdf(y) * height * conditionals[y].Pdf(x) * width;
+}
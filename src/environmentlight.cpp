@@ -0,0 +1,110 @@
+#include "environmentlight.h"
+#include "scene.h"
+#include "constants.h"
+
+namespace
+{
+	// a plain color only varies with the solid angle of the rows
+	const unsigned int ConstantEnvironmentWidth = 64;
+	const unsigned int ConstantEnvironmentHeight = 32;
+
+	float Luminance(const Color& c)
+	{
+		float y = 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+		return y > 0.0f ? y : 0.0f;
+	}
+}
+
+void EnvironmentLight::Build(const TexturedColor& environment, unsigned int maxWidth)
+{
+	Clear();
+
+	unsigned int width = ConstantEnvironmentWidth;
+	unsigned int height = ConstantEnvironmentHeight;
+	// texels averaged per cell and axis when the texture is larger than the table
+	unsigned int cellSamples = 1;
+	int textureWidth;
+	int textureHeight;
+	const TextureMap* map = environment.GetTexture();
+	if (map != nullptr && map->GetResolution(textureWidth, textureHeight) && textureWidth > 0 && textureHeight > 0)
+	{
+		width = (unsigned int)textureWidth;
+		height = (unsigned int)textureHeight;
+		if (width > maxWidth)
+		{
+			cellSamples = (width + maxWidth - 1) / maxWidth;
+			height = (unsigned int)((unsigned long long)height * maxWidth / width);
+			height = height > 0 ? height : 1;
+			width = maxWidth;
+		}
+	}
+
+	std::vector<float> weights((size_t)width * height);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		// solid angle of the row, cos of the elevation at its center
+		float v = (y + 0.5f) / height;
+		float cosElevation = cosf(PI * (v - 0.5f));
+		for (unsigned int x = 0; x < width; x++)
+		{
+			float sum = 0.0f;
+			for (unsigned int sy = 0; sy < cellSamples; sy++)
+			{
+				for (unsigned int sx = 0; sx < cellSamples; sx++)
+				{
+					Vec3f uvw((x + (sx + 0.5f) / cellSamples) / width, (y + (sy + 0.5f) / cellSamples) / height, 0.0f);
+					sum += Luminance(environment.Sample(uvw));
+				}
+			}
+			weights[(size_t)y * width + x] = sum / (cellSamples * cellSamples) * cosElevation;
+		}
+	}
+
+	distribution.Build(weights, width, height);
+}
+
+Vec3f EnvironmentLight::Sample(Vec2f u, float& pdf) const
+{
+	float uvPdf;
+	Vec2f uv = distribution.Sample(u, uvPdf);
+	float cosElevation = cosf(PI * (uv.y - 0.5f));
+	if (uvPdf <= 0.0f || cosElevation <= 0.0f)
+	{
+		pdf = 0.0f;
+		return Vec3f(0.0f, 0.0f, 1.0f);
+	}
+
+	// du dv covers 2 pi * pi * cos(elevation) steradians
+	pdf = uvPdf / (2.0f * PI * PI * cosElevation);
+	return UVToDirection(uv);
+}
+
+float EnvironmentLight::Pdf(const Vec3f& dir) const
+{
+	if (Empty())
+	{
+		return 0.0f;
+	}
+
+	Vec3f w = dir.GetNormalized();
+	float cosElevation = sqrtf(1.0f - w.z * w.z > 0.0f ? 1.0f - w.z * w.z : 0.0f);
+	if (cosElevation <= 0.0f)
+	{
+		return 0.0f;
+	}
+	return distribution.Pdf(DirectionToUV(w)) / (2.0f * PI * PI * cosElevation);
+}
+
+Vec2f EnvironmentLight::DirectionToUV(const Vec3f& dir)
+{
+	float z = dir.z < -1.0f ? -1.0f : (dir.z > 1.0f ? 1.0f : dir.z);
+	return Vec2f(0.5f - atan2f(dir.x, dir.y) / TWO_PI, 0.5f + asinf(z) / PI);
+}
+
+Vec3f EnvironmentLight::UVToDirection(Vec2f uv)
+{
+	float phi = TWO_PI * (0.5f - uv.x);
+	float elevation = PI * (uv.y - 0.5f);
+	float cosElevation = cosf(elevation);
+	return Vec3f(cosElevation * sinf(phi), cosElevation * cosf(phi), sinf(elevation));
+}
@@ -0,0 +1,546 @@
+#include "film.h"
+#include "tonemapping.h"
+#include "string_utils.h"
+#include "spdlog/spdlog.h"
+#include <fstream>
+#include <stdio.h>
+
+namespace
+{
+	float Luminance(const Color& color)
+	{
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
+
+	unsigned int GetChannelCount(AOVType type)
+	{
+		switch (type)
+		{
+		case AOVType::Depth:
+		case AOVType::Variance:
+		case AOVType::SampleCount:
+			return 1;
+		default:
+			return 3;
+		}
+	}
+
+	// derived layers are computed from the beauty when they are read
+	bool IsStored(AOVType type)
+	{
+		return type != AOVType::Variance && type != AOVType::SampleCount;
+	}
+
+	void AddVector(float* values, const Vec3f& v, float weight)
+	{
+		values[0] += v.x * weight;
+		values[1] += v.y * weight;
+		values[2] += v.z * weight;
+	}
+
+	void AddColor(float* values, const Color& c, float weight)
+	{
+		values[0] += c.r * weight;
+		values[1] += c.g * weight;
+		values[2] += c.b * weight;
+	}
+
+	const char CheckpointMagic[8] = { 'R', 'T', 'F', 'I', 'L', 'M', 'C', 'P' };
+	const uint32_t CheckpointVersion = 2;
+
+	struct CheckpointHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t pixelSize;
+		uint32_t width;
+		uint32_t height;
+		uint32_t layerCount;
+		uint32_t passCount;
+		uint32_t samplerType;
+		uint32_t reserved;
+		uint64_t seed;
+		uint64_t sceneHash;
+	};
+
+	struct CheckpointLayer
+	{
+		uint32_t type;
+		uint32_t lightIndex;
+		uint32_t channelCount;
+		uint32_t valueCount;
+	};
+
+	void ResetLayer(Film::Layer& layer, size_t pixelCount)
+	{
+		if (!IsStored(layer.type))
+		{
+			layer.values.clear();
+			return;
+		}
+		layer.values.assign(pixelCount * layer.channelCount, layer.type == AOVType::Depth ? BIGFLOAT : 0.0f);
+	}
+}
+
+void Film::Init(unsigned int _width, unsigned int _height)
+{
+	width = _width;
+	height = _height;
+	layers.clear();
+	lightLayerCount = 0;
+	Clear();
+}
+
+void Film::Clear()
+{
+	pixels.assign((size_t)width * height, Pixel());
+	for (Layer& layer : layers)
+	{
+		ResetLayer(layer, pixels.size());
+	}
+}
+
+void Film::AddLayer(AOVType type, unsigned int lightIndex)
+{
+	for (const Layer& layer : layers)
+	{
+		if (layer.type == type && (type != AOVType::Light || layer.lightIndex == lightIndex))
+		{
+			return;
+		}
+	}
+
+	Layer layer;
+	layer.type = type;
+	layer.lightIndex = type == AOVType::Light ? lightIndex : 0;
+	layer.channelCount = GetChannelCount(type);
+	ResetLayer(layer, pixels.size());
+	layers.push_back(std::move(layer));
+
+	if (type == AOVType::Light && lightIndex + 1 > lightLayerCount)
+	{
+		lightLayerCount = lightIndex + 1;
+	}
+}
+
+bool Film::HasLayer(AOVType type) const
+{
+	return FindLayer(type) != nullptr;
+}
+
+const Film::Layer* Film::FindLayer(AOVType type) const
+{
+	for (const Layer& layer : layers)
+	{
+		if (layer.type == type)
+		{
+			return &layer;
+		}
+	}
+	return nullptr;
+}
+
+void Film::PrepareSample(PixelContext& sample) const
+{
+	sample.lights.resize(lightLayerCount);
+}
+
+void Film::AddSample(unsigned int x, unsigned int y, const PixelContext& sample, float weight)
+{
+	unsigned int index = x + y * width;
+
+	Pixel& pixel = pixels[index];
+	pixel.sum += sample.color * weight;
+	pixel.weight += weight;
+	pixel.sampleCount++;
+	float luminance = Luminance(sample.color);
+	pixel.luminanceSquaredSum += luminance * luminance * weight;
+
+	for (Layer& layer : layers)
+	{
+		if (layer.values.empty())
+		{
+			continue;
+		}
+
+		float* values = &layer.values[(size_t)index * layer.channelCount];
+		switch (layer.type)
+		{
+		case AOVType::Albedo:
+			AddColor(values, sample.albedo, weight);
+			break;
+		case AOVType::Normal:
+			AddVector(values, sample.normal, weight);
+			break;
+		case AOVType::Position:
+			AddVector(values, sample.position, weight);
+			break;
+		case AOVType::Depth:
+			values[0] = sample.z < values[0] ? sample.z : values[0];
+			break;
+		case AOVType::Light:
+			if (layer.lightIndex < sample.lights.size())
+			{
+				AddColor(values, sample.lights[layer.lightIndex], weight);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+float Film::GetVariance(unsigned int x, unsigned int y) const
+{
+	const Pixel& pixel = pixels[x + y * width];
+	if (pixel.sampleCount < 2 || pixel.weight <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	float mean = Luminance(pixel.sum) / pixel.weight;
+	float meanSquared = pixel.luminanceSquaredSum / pixel.weight;
+	float variance = meanSquared - mean * mean;
+	// sample variance, divided once more by the count for the variance of the mean
+	return variance > 0.0f ? variance / (float)(pixel.sampleCount - 1) : 0.0f;
+}
+
+float Film::GetRelativeError(unsigned int x, unsigned int y) const
+{
+	const Pixel& pixel = pixels[x + y * width];
+	float mean = pixel.weight > 0.0f ? Luminance(pixel.sum) / pixel.weight : 0.0f;
+	return sqrtf(GetVariance(x, y)) / (mean > 0.01f ? mean : 0.01f);
+}
+
+void Film::GetLayerValue(const Layer& layer, unsigned int x, unsigned int y, float* values) const
+{
+	unsigned int index = x + y * width;
+	switch (layer.type)
+	{
+	case AOVType::Variance:
+		values[0] = GetVariance(x, y);
+		return;
+	case AOVType::SampleCount:
+		values[0] = (float)pixels[index].sampleCount;
+		return;
+	case AOVType::Depth:
+		values[0] = layer.values[index];
+		return;
+	default:
+		break;
+	}
+
+	float weight = pixels[index].weight;
+	float scale = weight > 0.0f ? 1.0f / weight : 0.0f;
+	for (unsigned int c = 0; c < layer.channelCount; c++)
+	{
+		values[c] = layer.values[(size_t)index * layer.channelCount + c] * scale;
+	}
+}
+
+void Film::GetScanline(unsigned int y, float* rgb) const
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		Color color = GetColor(x, y);
+		rgb[x * 3 + 0] = color.r;
+		rgb[x * 3 + 1] = color.g;
+		rgb[x * 3 + 2] = color.b;
+	}
+}
+
+std::vector<std::string> Film::GetChannelNames() const
+{
+	std::vector<std::string> names = { "R", "G", "B" };
+	for (const Layer& layer : layers)
+	{
+		switch (layer.type)
+		{
+		case AOVType::Albedo:
+			names.insert(names.end(), { "albedo.R", "albedo.G", "albedo.B" });
+			break;
+		case AOVType::Normal:
+			names.insert(names.end(), { "N.X", "N.Y", "N.Z" });
+			break;
+		case AOVType::Position:
+			names.insert(names.end(), { "P.X", "P.Y", "P.Z" });
+			break;
+		case AOVType::Depth:
+			names.push_back("Z");
+			break;
+		case AOVType::Variance:
+			names.push_back("variance.Y");
+			break;
+		case AOVType::SampleCount:
+			names.push_back("samples.Y");
+			break;
+		case AOVType::Light:
+		{
+			std::string prefix = StringUtils::Format("light%u.", layer.lightIndex);
+			names.insert(names.end(), { prefix + "R", prefix + "G", prefix + "B" });
+			break;
+		}
+		}
+	}
+	return names;
+}
+
+void Film::GetChannels(unsigned int y, float* values) const
+{
+	unsigned int channelCount = 3;
+	for (const Layer& layer : layers)
+	{
+		channelCount += layer.channelCount;
+	}
+
+	for (unsigned int x = 0; x < width; x++)
+	{
+		float* output = values + (size_t)x * channelCount;
+		Color color = GetColor(x, y);
+		output[0] = color.r;
+		output[1] = color.g;
+		output[2] = color.b;
+		output += 3;
+
+		for (const Layer& layer : layers)
+		{
+			GetLayerValue(layer, x, y, output);
+			output += layer.channelCount;
+		}
+	}
+}
+
+void Film::Resolve(RenderImage& image) const
+{
+	if ((unsigned int)image.GetWidth() != width || (unsigned int)image.GetHeight() != height)
+	{
+		return;
+	}
+
+	Color24* output = image.GetPixels();
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			output[x + y * width] = ToDisplay(GetColor(x, y));
+		}
+	}
+}
+
+Color24 Film::ToDisplay(const Color& color)
+{
+	static ToneMapping toneMapping;
+	Color mapped = toneMapping.ACES(Vec3f(color.r, color.g, color.b));
+	// gamma correction
+	return Color24(Color(powf(mapped.r, 0.4545f), powf(mapped.g, 0.4545f), powf(mapped.b, 0.4545f)));
+}
+
+bool Film::GetLayerPixel(AOVType type, unsigned int x, unsigned int y, float* values) const
+{
+	const Layer* layer = FindLayer(type);
+	if (layer == nullptr)
+	{
+		if (IsStored(type))
+		{
+			return false;
+		}
+		Layer derived;
+		derived.type = type;
+		derived.channelCount = GetChannelCount(type);
+		GetLayerValue(derived, x, y, values);
+		return true;
+	}
+	GetLayerValue(*layer, x, y, values);
+	return true;
+}
+
+void Film::ResolveLayer(AOVType type, Color24* output) const
+{
+	if (output == nullptr)
+	{
+		return;
+	}
+
+	Layer derived;
+	const Layer* layer = FindLayer(type);
+	if (layer == nullptr)
+	{
+		if (IsStored(type))
+		{
+			for (size_t i = 0; i < pixels.size(); i++)
+			{
+				output[i] = Color24::Black();
+			}
+			return;
+		}
+		derived.type = type;
+		derived.channelCount = GetChannelCount(type);
+		layer = &derived;
+	}
+
+	// single channel layers are stretched over their range, nearest or largest is white
+	if (layer->channelCount == 1)
+	{
+		float minValue = BIGFLOAT;
+		float maxValue = -BIGFLOAT;
+		for (unsigned int y = 0; y < height; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				float value;
+				GetLayerValue(*layer, x, y, &value);
+				if (value >= BIGFLOAT)
+				{
+					continue;
+				}
+				minValue = value < minValue ? value : minValue;
+				maxValue = value > maxValue ? value : maxValue;
+			}
+		}
+
+		for (unsigned int y = 0; y < height; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				float value;
+				GetLayerValue(*layer, x, y, &value);
+				float unit = 0.0f;
+				if (value < BIGFLOAT && maxValue > minValue)
+				{
+					unit = (value - minValue) / (maxValue - minValue);
+					unit = type == AOVType::Depth ? 1.0f - unit : unit;
+				}
+				output[x + y * width] = Color24(Color(unit, unit, unit));
+			}
+		}
+		return;
+	}
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			float value[3];
+			GetLayerValue(*layer, x, y, value);
+			Color color(value[0], value[1], value[2]);
+			if (type == AOVType::Normal)
+			{
+				color = Color(0.5f, 0.5f, 0.5f) + color * 0.5f;
+			}
+			output[x + y * width] = Color24(color);
+		}
+	}
+}
+
+bool Film::SaveCheckpoint(const std::string& path, const CheckpointInfo& info) const
+{
+	CheckpointHeader header = {};
+	memcpy(header.magic, CheckpointMagic, sizeof(CheckpointMagic));
+	header.version = CheckpointVersion;
+	header.pixelSize = sizeof(Pixel);
+	header.width = width;
+	header.height = height;
+	header.layerCount = (uint32_t)layers.size();
+	header.passCount = info.passCount;
+	header.samplerType = info.samplerType;
+	header.seed = info.seed;
+	header.sceneHash = info.sceneHash;
+
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			return false;
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)pixels.data(), (std::streamsize)(pixels.size() * sizeof(Pixel)));
+		for (const Layer& layer : layers)
+		{
+			CheckpointLayer layerHeader = { (uint32_t)layer.type, layer.lightIndex, layer.channelCount, (uint32_t)layer.values.size() };
+			file.write((const char*)&layerHeader, sizeof(layerHeader));
+			file.write((const char*)layer.values.data(), (std::streamsize)(layer.values.size() * sizeof(float)));
+		}
+
+		if (!file)
+		{
+			file.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// rename does not replace an existing file everywhere
+	remove(path.c_str());
+	if (rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Film::LoadCheckpoint(const std::string& path, CheckpointInfo& info)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	CheckpointHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file
+		|| memcmp(header.magic, CheckpointMagic, sizeof(CheckpointMagic)) != 0
+		|| header.version != CheckpointVersion
+		|| header.pixelSize != sizeof(Pixel)
+		|| header.width != width
+		|| header.height != height
+		|| header.layerCount != layers.size())
+	{
+		return false;
+	}
+
+	if (header.sceneHash != info.sceneHash)
+	{
+		spdlog::warn("checkpoint {} was rendered from a different scene or camera", path);
+		return false;
+	}
+
+	// read everything aside first, a short file must not leave half a checkpoint in the film
+	std::vector<Pixel> loadedPixels(pixels.size());
+	file.read((char*)loadedPixels.data(), (std::streamsize)(loadedPixels.size() * sizeof(Pixel)));
+
+	std::vector<std::vector<float>> loadedValues(layers.size());
+	for (size_t i = 0; i < layers.size() && file; i++)
+	{
+		CheckpointLayer layerHeader;
+		file.read((char*)&layerHeader, sizeof(layerHeader));
+		if (!file
+			|| layerHeader.type != (uint32_t)layers[i].type
+			|| layerHeader.lightIndex != layers[i].lightIndex
+			|| layerHeader.channelCount != layers[i].channelCount
+			|| layerHeader.valueCount != layers[i].values.size())
+		{
+			return false;
+		}
+		loadedValues[i].resize(layerHeader.valueCount);
+		file.read((char*)loadedValues[i].data(), (std::streamsize)(loadedValues[i].size() * sizeof(float)));
+	}
+	if (!file)
+	{
+		return false;
+	}
+
+	pixels.swap(loadedPixels);
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		layers[i].values.swap(loadedValues[i]);
+	}
+
+	info.passCount = header.passCount;
+	info.samplerType = header.samplerType;
+	info.seed = header.seed;
+	return true;
+}
@@ -0,0 +1,222 @@
+#include "imageio.h"
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+	// both formats are written little endian, which is what every platform we build on uses
+	template <typename T>
+	void Write(std::ofstream& file, const T& value)
+	{
+		file.write((const char*)&value, sizeof(T));
+	}
+
+	void WriteString(std::ofstream& file, const std::string& value)
+	{
+		file.write(value.c_str(), value.size() + 1);
+	}
+
+	void WriteAttributeHeader(std::ofstream& file, const char* name, const char* type, int32_t size)
+	{
+		WriteString(file, name);
+		WriteString(file, type);
+		Write(file, size);
+	}
+
+	void WriteBox(std::ofstream& file, const char* name, int32_t xMax, int32_t yMax)
+	{
+		WriteAttributeHeader(file, name, "box2i", 16);
+		Write(file, (int32_t)0);
+		Write(file, (int32_t)0);
+		Write(file, xMax);
+		Write(file, yMax);
+	}
+}
+
+uint16_t ImageIO::FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent == 0xff)
+	{
+		// inf stays inf, nan keeps a mantissa bit
+		return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+	}
+
+	int halfExponent = (int)exponent - 127 + 15;
+	if (halfExponent >= 0x1f)
+	{
+		return sign | 0x7c00;
+	}
+	if (halfExponent <= 0)
+	{
+		if (halfExponent < -10)
+		{
+			return sign;
+		}
+		// denormal, shift in the implicit one and round to nearest even
+		mantissa |= 0x800000;
+		uint32_t shift = (uint32_t)(14 - halfExponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+		{
+			half++;
+		}
+		return sign | (uint16_t)half;
+	}
+
+	uint32_t half = ((uint32_t)halfExponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	// a carry out of the mantissa correctly bumps the exponent, up to inf
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+	{
+		half++;
+	}
+	return sign | (uint16_t)half;
+}
+
+std::string ImageIO::GetFormat(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos)
+	{
+		return "png";
+	}
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+	return extension == "pfm" || extension == "exr" ? extension : "png";
+}
+
+bool ImageIO::WritePFM(const std::string& path, unsigned int width, unsigned int height, const ScanlineFunc& scanline)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+
+	// a negative scale marks little endian data
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+
+	// rows are stored bottom to top
+	std::vector<float> row((size_t)width * 3);
+	for (unsigned int i = 0; i < height; i++)
+	{
+		scanline(height - 1 - i, row.data());
+		file.write((const char*)row.data(), (std::streamsize)(row.size() * sizeof(float)));
+	}
+
+	return (bool)file;
+}
+
+bool ImageIO::WriteEXR(const std::string& path, unsigned int width, unsigned int height,
+	const std::vector<std::string>& channels, PixelType type, const ScanlineFunc& scanline)
+{
+	if (channels.empty() || width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+
+	// the channel list has to be sorted by name, the data of a line follows the same order
+	std::vector<unsigned int> order(channels.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return channels[a] < channels[b]; });
+
+	const int32_t pixelType = type == PixelType::Half ? 1 : 2;
+	const unsigned int sampleSize = type == PixelType::Half ? 2 : 4;
+
+	Write(file, (uint32_t)20000630);
+	// version 2, single part scanline file
+	Write(file, (uint32_t)2);
+
+	int32_t channelListSize = 1;
+	for (const std::string& name : channels)
+	{
+		channelListSize += (int32_t)name.size() + 1 + 16;
+	}
+	WriteAttributeHeader(file, "channels", "chlist", channelListSize);
+	for (unsigned int channel : order)
+	{
+		WriteString(file, channels[channel]);
+		Write(file, pixelType);
+		// pLinear and three reserved bytes
+		Write(file, (uint32_t)0);
+		Write(file, (int32_t)1);
+		Write(file, (int32_t)1);
+	}
+	Write(file, (uint8_t)0);
+
+	WriteAttributeHeader(file, "compression", "compression", 1);
+	Write(file, (uint8_t)0);
+	WriteBox(file, "dataWindow", (int32_t)width - 1, (int32_t)height - 1);
+	WriteBox(file, "displayWindow", (int32_t)width - 1, (int32_t)height - 1);
+	WriteAttributeHeader(file, "lineOrder", "lineOrder", 1);
+	Write(file, (uint8_t)0);
+	WriteAttributeHeader(file, "pixelAspectRatio", "float", 4);
+	Write(file, 1.0f);
+	WriteAttributeHeader(file, "screenWindowCenter", "v2f", 8);
+	Write(file, 0.0f);
+	Write(file, 0.0f);
+	WriteAttributeHeader(file, "screenWindowWidth", "float", 4);
+	Write(file, 1.0f);
+	Write(file, (uint8_t)0);
+
+	// uncompressed, so every chunk is one line of the same size and the offsets are known up front
+	uint64_t lineSize = (uint64_t)width * channels.size() * sampleSize;
+	uint64_t chunkStart = (uint64_t)file.tellp() + (uint64_t)height * sizeof(uint64_t);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		Write(file, chunkStart + y * (lineSize + 8));
+	}
+
+	unsigned int channelCount = (unsigned int)channels.size();
+	std::vector<float> values((size_t)width * channelCount);
+	std::vector<char> line((size_t)lineSize);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		scanline(y, values.data());
+
+		// interleaved to one run of samples per channel
+		char* output = line.data();
+		for (unsigned int channel : order)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				float value = values[x * channelCount + channel];
+				if (type == PixelType::Half)
+				{
+					uint16_t half = FloatToHalf(value);
+					memcpy(output, &half, sizeof(half));
+				}
+				else
+				{
+					memcpy(output, &value, sizeof(value));
+				}
+				output += sampleSize;
+			}
+		}
+
+		Write(file, (int32_t)y);
+		Write(file, (int32_t)lineSize);
+		file.write(line.data(), (std::streamsize)line.size());
+	}
+
+	return (bool)file;
+}
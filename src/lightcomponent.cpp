@@ -1,12 +1,45 @@
 #include "lightcomponent.h"
 #include "cyColor.h"
 #include "utils.h"
+#include "rng.h"
 
 cy::Color LightComponent::Le() const
 {
 	return intensity;
 }
 
+float LightComponent::Power() const
+{
+	// objects without an area still get picked by their intensity
+	float area = parent && parent->GetNodeObj() ? parent->GetNodeObj()->Area() : 0.0f;
+	return intensity.Sum() / 3.0f * (area > 0.0f ? area : 1.0f);
+}
+
+LightBounds LightComponent::Bounds() const
+{
+	LightBounds result;
+	auto obj = parent->GetNodeObj();
+	if (obj == nullptr)
+	{
+		return result;
+	}
+
+	Box localBounds = obj->GetBoundBox();
+	for (int i = 0; i < 8; i++)
+	{
+		result.bounds += parent->TransformPointToWorld(localBounds.Corner(i));
+	}
+	result.phi = Power();
+	if (!obj->NormalBounds(result.w, result.cosThetaO))
+	{
+		result.w = Vec3f(0.0f, 0.0f, 1.0f);
+		result.cosThetaO = -1.0f;
+	}
+	// lights only emit from their front side
+	result.cosThetaE = 0.0f;
+	return result;
+}
+
 // MISõ,Ѿȷе,һ¶ӦLe
 cy::Color LightComponent::ComputeLe(const Vec3f& lightPos, const Vec3f& lightNormal , const Vec3f& objPos, const Vec3f& wi) const
 {
@@ -17,57 +50,50 @@ cy::Color LightComponent::ComputeLe(const Vec3f& lightPos, const Vec3f& lightNor
 	return Le() / pdf;
 }
 
-float LightComponent::Pdf(const HitInfo& hitInfo, const Interaction& sampleInteraction, float distance)
-{
-	auto obj = parent->GetNodeObj();
-	float distanceSquare = distance * distance;
-	float area = obj->Area();
-
-	Vec3f neggativeWi = (hitInfo.p - sampleInteraction.p).GetNormalized();
-
-	const Vec3f& normal = sampleInteraction.n;
-	float cosNormalDotNeggativeWi = Max(neggativeWi.Dot(normal), 0.0001f);
-
-	float pdf = distanceSquare / (area * cosNormalDotNeggativeWi);
-	return pdf;
-}
-
 float LightComponent::Pdf(const HitInfo& hitInfo, const Vec3f& wi)
 {
+	Ray ray(hitInfo.p + hitInfo.N * INTERSECTION_BIAS, wi);
+
+	// only the light itself needs a full hit, everything in between is a boolean
 	HitInfo lightHitInfo;
-	if (LightVisTest(Ray(hitInfo.p + hitInfo.N * INTERSECTION_BIAS, wi), lightHitInfo,
-		BIGFLOAT, parent))
+	if (!IntersectNode(ray, lightHitInfo, parent, HIT_FRONT_AND_BACK) || !lightHitInfo.front)
 	{
 		return 0.0f;
 	}
-	else
-	{
-		Interaction lightInter;
-		lightInter.n = lightHitInfo.N;
-		lightInter.p = lightHitInfo.p;
 
-		return Pdf(hitInfo, lightInter, (lightHitInfo.p - hitInfo.p).Length());
+	if (Occluded(ray, 0.0f, lightHitInfo.z, parent))
+	{
+		return 0.0f;
 	}
+
+	Interaction lightInter;
+	lightInter.n = lightHitInfo.N;
+	lightInter.p = lightHitInfo.p;
+
+	return parent->GetNodeObj()->SolidAnglePdf(hitInfo.p, lightInter);
 }
 
-cy::Color LightComponent::SampleLi(const HitInfo& hitInfo, float& pdf, Vec3f& wi)
+cy::Color LightComponent::SampleLi(const HitInfo& hitInfo, float& pdf, Vec3f& wi, SamplerContext& sampler)
 {
 	auto obj = parent->GetNodeObj();
-	Interaction it = obj->Sample();
+	Interaction it = obj->SampleSolidAngle(hitInfo.p, sampler, pdf);
 	auto& samplePoint = it.p;
 
 	wi = (samplePoint - hitInfo.p).GetNormalized();
 
 	float distance = (hitInfo.p - samplePoint).Length();
 
-	pdf = Pdf(hitInfo, it, distance);
+	// lights only emit from their front side
+	if (it.n.Dot(wi) >= 0.0f)
+	{
+		return Color::Black();
+	}
 
-	HitInfo lightHitInfo;
-	// test visibility
-	if (LightVisTest(Ray(hitInfo.p + hitInfo.N * INTERSECTION_BIAS, wi), lightHitInfo,(hitInfo.p - samplePoint).Length(), parent))
+	// test visibility, stop short of the sampled point so the light surface doesn't occlude itself
+	if (Occluded(Ray(hitInfo.p + hitInfo.N * INTERSECTION_BIAS, wi), 0.0f, distance * (1.0f - SHADOW_EPSILON), parent))
 	{
 		return Color::Black();
 	}
 
 	return Le();
-}
\ No newline at end of file
+}
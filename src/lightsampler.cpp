@@ -0,0 +1,346 @@
+#include "lightsampler.h"
+#include "lightcomponent.h"
+#include "constants.h"
+#include <algorithm>
+
+namespace
+{
+	const int LightBVHBucketCount = 12;
+
+	float SafeSqrt(float x)
+	{
+		return sqrtf(x > 0.0f ? x : 0.0f);
+	}
+
+	float SafeACos(float x)
+	{
+		return acosf(x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x));
+	}
+
+	// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+	float CosSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+	}
+
+	float SinSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+	}
+
+	// v rotated by angle around the unit axis, Rodrigues' formula
+	Vec3f Rotate(const Vec3f& v, const Vec3f& axis, float angle)
+	{
+		float c = cosf(angle);
+		float s = sinf(angle);
+		return v * c + axis.Cross(v) * s + axis * (axis.Dot(v) * (1.0f - c));
+	}
+
+	float SurfaceArea(const Box& box)
+	{
+		Vec3f d = box.pmax - box.pmin;
+		return 2.0f * (d.x * d.y + d.x * d.z + d.y * d.z);
+	}
+
+	// Cost of a node for the surface area orientation heuristic: power times the solid angle its
+	// emission may cover times its area, stretched when the split axis is short.
+	float EvaluateCost(const LightBounds& b, const Box& parentBounds, int dim)
+	{
+		float thetaO = SafeACos(b.cosThetaO);
+		float thetaE = SafeACos(b.cosThetaE);
+		float thetaW = thetaO + thetaE < PI ? thetaO + thetaE : PI;
+		float sinThetaO = SafeSqrt(1.0f - b.cosThetaO * b.cosThetaO);
+		float mOmega = 2.0f * PI * (1.0f - b.cosThetaO)
+			+ PI / 2.0f * (2.0f * thetaW * sinThetaO - cosf(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + b.cosThetaO);
+
+		Vec3f d = parentBounds.pmax - parentBounds.pmin;
+		float kr = d.Max() / (d[dim] > 0.0f ? d[dim] : 1.0f);
+		return b.phi * mOmega * kr * SurfaceArea(b.bounds);
+	}
+}
+
+float LightBounds::Importance(const Vec3f& p, const Vec3f& n) const
+{
+	Vec3f pc = (bounds.pmin + bounds.pmax) * 0.5f;
+	float d2 = (p - pc).LengthSquared();
+	float halfDiagonal = (bounds.pmax - bounds.pmin).Length() / 2.0f;
+	d2 = d2 > halfDiagonal ? d2 : halfDiagonal;
+
+	Vec3f wi = (p - pc).GetNormalized();
+	float cosThetaW = w.Dot(wi);
+	float sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+
+	// the angle the bounds cover seen from p, everything if p is inside their bounding sphere
+	float cosThetaB = -1.0f;
+	float radius2 = halfDiagonal * halfDiagonal;
+	float distance2 = (p - pc).LengthSquared();
+	if (!bounds.IsInside(p) && distance2 > radius2)
+	{
+		cosThetaB = SafeSqrt(1.0f - radius2 / distance2);
+	}
+	float sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+
+	// smallest angle between a normal in the cone and a direction towards p
+	float sinThetaO = SafeSqrt(1.0f - cosThetaO * cosThetaO);
+	float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= cosThetaE)
+	{
+		return 0.0f;
+	}
+
+	float importance = phi * cosThetaP / d2;
+
+	// and the smallest angle to the surface normal at p, either side for transmission
+	float cosThetaI = fabsf(wi.Dot(n));
+	float sinThetaI = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+	importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+	return importance > 0.0f ? importance : 0.0f;
+}
+
+LightBounds LightBounds::Union(const LightBounds& a, const LightBounds& b)
+{
+	if (a.phi == 0.0f)
+	{
+		return b;
+	}
+	if (b.phi == 0.0f)
+	{
+		return a;
+	}
+
+	LightBounds result;
+	result.bounds = a.bounds;
+	result.bounds += b.bounds;
+	result.phi = a.phi + b.phi;
+	result.cosThetaE = a.cosThetaE < b.cosThetaE ? a.cosThetaE : b.cosThetaE;
+
+	// smallest cone around both normal cones
+	float thetaA = SafeACos(a.cosThetaO);
+	float thetaB = SafeACos(b.cosThetaO);
+	float thetaD = SafeACos(a.w.Dot(b.w));
+	if (thetaD + thetaB <= thetaA || thetaA >= PI)
+	{
+		result.w = a.w;
+		result.cosThetaO = a.cosThetaO;
+		return result;
+	}
+	if (thetaD + thetaA <= thetaB || thetaB >= PI)
+	{
+		result.w = b.w;
+		result.cosThetaO = b.cosThetaO;
+		return result;
+	}
+
+	float thetaO = (thetaA + thetaD + thetaB) / 2.0f;
+	Vec3f axis = a.w.Cross(b.w);
+	if (thetaO >= PI || axis.LengthSquared() == 0.0f)
+	{
+		result.w = a.w;
+		result.cosThetaO = -1.0f;
+		return result;
+	}
+
+	result.w = Rotate(a.w, axis.GetNormalized(), thetaO - thetaA).GetNormalized();
+	result.cosThetaO = cosf(thetaO);
+	return result;
+}
+
+void LightBVH::Build(const std::vector<LightComponent*>& lights)
+{
+	nodes.clear();
+
+	// lights without power are never worth a shadow ray
+	std::vector<BuildLight> buildLights;
+	for (int i = 0; i < (int)lights.size(); i++)
+	{
+		LightBounds bounds = lights[i]->Bounds();
+		if (bounds.phi > 0.0f && !bounds.bounds.IsEmpty())
+		{
+			buildLights.push_back({ i, bounds });
+		}
+	}
+
+	if (!buildLights.empty())
+	{
+		nodes.reserve(2 * buildLights.size() - 1);
+		BuildRecursive(buildLights, 0, (int)buildLights.size());
+	}
+}
+
+int LightBVH::BuildRecursive(std::vector<BuildLight>& lights, int begin, int end)
+{
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(BVHNode());
+	if (end - begin == 1)
+	{
+		nodes[nodeIndex].bounds = lights[begin].bounds;
+		nodes[nodeIndex].lightIndex = lights[begin].index;
+		return nodeIndex;
+	}
+
+	Box bounds;
+	Box centroidBounds;
+	for (int i = begin; i < end; i++)
+	{
+		const Box& lightBox = lights[i].bounds.bounds;
+		bounds += lightBox;
+		centroidBounds += (lightBox.pmin + lightBox.pmax) * 0.5f;
+	}
+
+	// bucketed surface area orientation heuristic over all three axes
+	float minCost = BIGFLOAT;
+	int minDim = -1;
+	int minBucket = -1;
+	for (int dim = 0; dim < 3; dim++)
+	{
+		float extent = centroidBounds.pmax[dim] - centroidBounds.pmin[dim];
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		LightBounds buckets[LightBVHBucketCount];
+		for (int i = begin; i < end; i++)
+		{
+			const Box& lightBox = lights[i].bounds.bounds;
+			float centroid = (lightBox.pmin[dim] + lightBox.pmax[dim]) * 0.5f;
+			int bucket = (int)(LightBVHBucketCount * (centroid - centroidBounds.pmin[dim]) / extent);
+			bucket = bucket < LightBVHBucketCount ? bucket : LightBVHBucketCount - 1;
+			buckets[bucket] = LightBounds::Union(buckets[bucket], lights[i].bounds);
+		}
+
+		for (int split = 1; split < LightBVHBucketCount; split++)
+		{
+			LightBounds below;
+			LightBounds above;
+			for (int i = 0; i < split; i++)
+			{
+				below = LightBounds::Union(below, buckets[i]);
+			}
+			for (int i = split; i < LightBVHBucketCount; i++)
+			{
+				above = LightBounds::Union(above, buckets[i]);
+			}
+			if (below.phi == 0.0f || above.phi == 0.0f)
+			{
+				continue;
+			}
+
+			float cost = EvaluateCost(below, bounds, dim) + EvaluateCost(above, bounds, dim);
+			if (cost < minCost)
+			{
+				minCost = cost;
+				minDim = dim;
+				minBucket = split;
+			}
+		}
+	}
+
+	int middle = begin + (end - begin) / 2;
+	if (minDim >= 0)
+	{
+		float extent = centroidBounds.pmax[minDim] - centroidBounds.pmin[minDim];
+		auto split = std::partition(lights.begin() + begin, lights.begin() + end, [&](const BuildLight& light)
+		{
+			const Box& lightBox = light.bounds.bounds;
+			float centroid = (lightBox.pmin[minDim] + lightBox.pmax[minDim]) * 0.5f;
+			int bucket = (int)(LightBVHBucketCount * (centroid - centroidBounds.pmin[minDim]) / extent);
+			bucket = bucket < LightBVHBucketCount ? bucket : LightBVHBucketCount - 1;
+			return bucket < minBucket;
+		});
+		int splitIndex = (int)(split - lights.begin());
+		if (splitIndex > begin && splitIndex < end)
+		{
+			middle = splitIndex;
+		}
+	}
+
+	int firstChild = BuildRecursive(lights, begin, middle);
+	int secondChild = BuildRecursive(lights, middle, end);
+	nodes[nodeIndex].secondChild = secondChild;
+	nodes[nodeIndex].bounds = LightBounds::Union(nodes[firstChild].bounds, nodes[secondChild].bounds);
+	return nodeIndex;
+}
+
+float LightBVH::ChildImportance(int nodeIndex, const Vec3f& p, const Vec3f& n, int excluded) const
+{
+	const BVHNode& node = nodes[nodeIndex];
+	if (node.secondChild < 0 && node.lightIndex == excluded)
+	{
+		return 0.0f;
+	}
+	return node.bounds.Importance(p, n);
+}
+
+int LightBVH::Sample(const Vec3f& p, const Vec3f& n, float u, int excluded, float& pmf) const
+{
+	pmf = 0.0f;
+	if (nodes.empty() || ChildImportance(0, p, n, excluded) <= 0.0f)
+	{
+		return -1;
+	}
+
+	float probability = 1.0f;
+	int nodeIndex = 0;
+	while (nodes[nodeIndex].secondChild >= 0)
+	{
+		const BVHNode& node = nodes[nodeIndex];
+		float importance0 = ChildImportance(nodeIndex + 1, p, n, excluded);
+		float importance1 = ChildImportance(node.secondChild, p, n, excluded);
+		if (importance0 <= 0.0f && importance1 <= 0.0f)
+		{
+			return -1;
+		}
+
+		// u is reused at every level, rescaled to the part that picked the child
+		float p0 = importance0 / (importance0 + importance1);
+		if (u < p0)
+		{
+			nodeIndex = nodeIndex + 1;
+			u = u / p0;
+			probability *= p0;
+		}
+		else
+		{
+			nodeIndex = node.secondChild;
+			u = (u - p0) / (1.0f - p0);
+			probability *= 1.0f - p0;
+		}
+		u = u < 0x1.fffffep-1f ? u : 0x1.fffffep-1f;
+	}
+
+	pmf = probability;
+	return nodes[nodeIndex].lightIndex;
+}
+
+void LightSampler::Build(const std::vector<LightComponent*>& lights, LightSamplerType _type)
+{
+	type = _type;
+	powerDistribution.Clear();
+	bvh.Clear();
+
+	if (type == LightSamplerType::BVH)
+	{
+		bvh.Build(lights);
+		return;
+	}
+
+	std::vector<float> powers(lights.size());
+	for (unsigned int i = 0; i < lights.size(); i++)
+	{
+		powers[i] = lights[i]->Power();
+	}
+	powerDistribution.Build(powers);
+}
+
+int LightSampler::Sample(const Vec3f& p, const Vec3f& n, float u, int excluded, float& pmf) const
+{
+	if (type == LightSamplerType::BVH)
+	{
+		return bvh.Sample(p, n, u, excluded, pmf);
+	}
+	return powerDistribution.SampleExcluding(u, excluded, &pmf);
+}
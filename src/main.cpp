@@ -1,16 +1,173 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "spdlog/spdlog.h"
 
 #include "application.h"
+#include "raytracer.h"
+#include "string_utils.h"
 
 #ifdef _WIN32
 #include <direct.h>
-#include "string_utils.h"
 #endif
-int main(int, char** args) 
+static void PrintUsage()
+{
+	printf("usage: RayTracer [--headless] [--scene file.xml] [--spp count] [--time seconds] [--threads count] [--tile pixels] [--seed value] [--sampler sobol|random] [--light-sampler bvh|power] [--aov list] [--adaptive error] [--denoise] [--checkpoint file] [--checkpoint-interval seconds] [--resume] [--output file.png]\n");
+}
+
+// comma separated layer names, as in "albedo,normal,depth"
+static bool ParseAOVs(const std::string& list, std::vector<AOVType>& aovs)
+{
+	for (const std::string& name : StringUtils::Split(list, ",", true))
+	{
+		if (name == "albedo") aovs.push_back(AOVType::Albedo);
+		else if (name == "normal") aovs.push_back(AOVType::Normal);
+		else if (name == "position") aovs.push_back(AOVType::Position);
+		else if (name == "depth") aovs.push_back(AOVType::Depth);
+		else if (name == "variance") aovs.push_back(AOVType::Variance);
+		else if (name == "samples") aovs.push_back(AOVType::SampleCount);
+		else if (name == "lights") aovs.push_back(AOVType::Light);
+		else
+		{
+			printf("unknown aov %s\n", name.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+// Headless mode renders the scene once, writes the image and exits, no window or GL context is created.
+// Returns -1 to continue with the interactive viewer.
+static int RunFromCommandLine(int argc, char** args)
+{
+	RayTracer rayTracer;
+	bool headless = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = args[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--headless")
+		{
+			headless = true;
+		}
+		else if (arg == "--scene" && hasValue)
+		{
+			rayTracer.scene_path = args[++i];
+		}
+		else if (arg == "--spp" && hasValue)
+		{
+			rayTracer.settings.samplesPerPixel = (unsigned int)atoi(args[++i]);
+		}
+		else if (arg == "--time" && hasValue)
+		{
+			rayTracer.settings.timeBudget = (float)atof(args[++i]);
+		}
+		else if (arg == "--threads" && hasValue)
+		{
+			rayTracer.settings.threadCount = (unsigned int)atoi(args[++i]);
+		}
+		else if (arg == "--tile" && hasValue)
+		{
+			rayTracer.settings.tileSize = (unsigned int)atoi(args[++i]);
+		}
+		else if (arg == "--seed" && hasValue)
+		{
+			rayTracer.settings.seed = strtoull(args[++i], nullptr, 10);
+		}
+		else if (arg == "--light-sampler" && hasValue)
+		{
+			std::string type = args[++i];
+			if (type == "bvh")
+			{
+				rayTracer.settings.lightSampler = LightSamplerType::BVH;
+			}
+			else if (type == "power")
+			{
+				rayTracer.settings.lightSampler = LightSamplerType::Power;
+			}
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (arg == "--sampler" && hasValue)
+		{
+			std::string type = args[++i];
+			if (type == "random")
+			{
+				rayTracer.settings.sampler = SamplerType::Random;
+			}
+			else if (type == "sobol")
+			{
+				rayTracer.settings.sampler = SamplerType::Sobol;
+			}
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (arg == "--aov" && hasValue)
+		{
+			if (!ParseAOVs(args[++i], rayTracer.settings.aovs))
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (arg == "--adaptive" && hasValue)
+		{
+			rayTracer.settings.adaptiveThreshold = (float)atof(args[++i]);
+		}
+		else if (arg == "--denoise")
+		{
+			rayTracer.denoise = true;
+		}
+		else if (arg == "--checkpoint" && hasValue)
+		{
+			rayTracer.settings.checkpointPath = args[++i];
+		}
+		else if (arg == "--checkpoint-interval" && hasValue)
+		{
+			rayTracer.settings.checkpointInterval = (float)atof(args[++i]);
+		}
+		else if (arg == "--resume")
+		{
+			rayTracer.settings.resume = true;
+		}
+		else if (arg == "--output" && hasValue)
+		{
+			rayTracer.outputPath = args[++i];
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (!headless)
+	{
+		if (argc > 1)
+		{
+			printf("--scene, --spp, --time, --threads, --tile, --seed, --sampler, --light-sampler, --aov, --adaptive, --denoise, --checkpoint, --resume and --output need --headless\n");
+			PrintUsage();
+			return 1;
+		}
+		return -1;
+	}
+
+	return rayTracer.RunHeadless();
+}
+
+int main(int argc, char** args) 
 {
 
 #ifdef _WIN32
@@ -29,6 +186,12 @@ int main(int, char** args)
     spdlog::set_pattern("[thread %t] %v");
     spdlog::set_level(spdlog::level::debug);
 
+    int exitCode = RunFromCommandLine(argc, args);
+    if (exitCode >= 0)
+    {
+        return exitCode;
+    }
+
     auto app = std::make_shared<Application>();
     app->Run();
     
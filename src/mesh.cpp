@@ -1,14 +1,128 @@
 #include "mesh.h"
 #include "bvh.h"
+#include "bvhcache.h"
+#include <set>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 extern BVHManager bvhManager;
+extern float buildTime;
+
+namespace
+{
+	struct BVHBuildResult
+	{
+		MeshBVHNew* bvh = nullptr;
+		uint64_t hash = 0;
+		bool loaded = false;
+	};
+
+	// touches nothing shared, so meshes can go through it on different threads
+	BVHBuildResult LoadOrBuildBVH(Mesh* mesh)
+	{
+		BVHBuildResult result;
+		if (bvhBuildSettings.useCache)
+		{
+			result.hash = BVHCache::HashMesh(*mesh, bvhBuildSettings);
+			result.bvh = BVHCache::Load(result.hash, mesh);
+			result.loaded = result.bvh != nullptr;
+		}
+
+		if (result.bvh == nullptr)
+		{
+			result.bvh = new MeshBVHNew(mesh);
+		}
+		return result;
+	}
+
+	// main thread only, in mesh order
+	void RegisterBVH(Mesh* mesh, const BVHBuildResult& result)
+	{
+		MeshBVHNew* bvh = result.bvh;
+		mesh->bvh = bvh;
+		bvhManager.Set(mesh->path, bvh);
+		buildTime += bvh->GetBuildTime();
+
+		if (result.loaded)
+		{
+			spdlog::info("bvh of {} loaded from {} in {}s, {} faces", mesh->path, BVHCache::GetPath(result.hash), bvh->GetBuildTime(), mesh->faces.size());
+			return;
+		}
+
+		spdlog::info("bvh of {} built in {}s, {} faces", mesh->path, bvh->GetBuildTime(), mesh->faces.size());
+		if (bvhBuildSettings.useCache)
+		{
+			BVHCache::Save(result.hash, *bvh);
+		}
+	}
+}
 
 void Mesh::BuildBVH()
 {
 	bvh = bvhManager.Get(path);
-	if (bvh == nullptr)
+	if (bvh != nullptr)
+	{
+		return;
+	}
+
+	RegisterBVH(this, LoadOrBuildBVH(this));
+}
+
+void Mesh::BuildBVHs(const std::vector<Mesh*>& meshes)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// the first mesh of every path builds, the rest pick its bvh up from the manager afterwards
+	std::vector<Mesh*> builds;
+	std::set<std::string> paths;
+	for (Mesh* mesh : meshes)
+	{
+		if (bvhManager.Get(mesh->path) == nullptr && paths.insert(mesh->path).second)
+		{
+			builds.push_back(mesh);
+		}
+	}
+
+	std::vector<BVHBuildResult> results(builds.size());
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < builds.size(); i = next++)
+		{
+			results[i] = LoadOrBuildBVH(builds[i]);
+		}
+	};
+
+	size_t workerCount = Min((size_t)std::thread::hardware_concurrency(), builds.size());
+	if (workerCount == 0)
+	{
+		workerCount = 1;
+	}
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < workerCount; i++)
+	{
+		workers.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto& thread : workers)
+	{
+		thread.join();
+	}
+
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		RegisterBVH(builds[i], results[i]);
+	}
+
+	for (Mesh* mesh : meshes)
+	{
+		mesh->BuildBVH();
+	}
+
+	if (!builds.empty())
 	{
-		bvh = new MeshBVHNew(this);
-		bvhManager.Set(path, bvh);
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		spdlog::info("{} mesh bvhs ready in {}s on {} threads", builds.size(), seconds, workerCount);
 	}
-}
\ No newline at end of file
+}
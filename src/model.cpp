@@ -1,165 +1,141 @@
 #include "model.h"
 #include "bvh.h"
 
-bool Model::TraceBVHNode(Ray const& ray, HitInfo& hInfo, int hitSide, Mesh& mesh, BVHNode* node) const
+void Model::FillHitInfo(Ray const& ray, TriangleHit const& hit, HitInfo& hInfo, Mesh& mesh) const
 {
-	if (node->IsLeaf())
+	const Face& face = mesh.faces[hit.faceId];
+
+	float beta0 = 1.0f - hit.u - hit.v;
+	float beta1 = hit.u;
+	float beta2 = hit.v;
+
+	Vec3f p = ray.p + ray.dir * hit.t;
+
+	const glm::vec3& n0 = mesh.normals[face.indices[0]];
+	const glm::vec3& n1 = mesh.normals[face.indices[1]];
+	const glm::vec3& n2 = mesh.normals[face.indices[2]];
+
+	glm::vec3 normal = glm::normalize(beta0 * n0 + beta1 * n1 + beta2 * n2);
+	float normalSum = normal.x + normal.y + normal.z;
+	if (isnan(normalSum) || isinf(normalSum))
 	{
-		bool result = false;
-		for (unsigned i = 0; i < node->faceList.size(); i++)
-		{
-			unsigned faceId = node->faceList[i];
-			HitInfo currentHitInfo;
-			
-			if (IntersectRayWithFace(ray, currentHitInfo, hitSide, mesh, mesh.faces[faceId]))
-			{
-				if (currentHitInfo.z < hInfo.z)
-				{
-					result = true;
-
-					hInfo.Copy(currentHitInfo);
-				}
-			}
-		}
-		return result;
+		const glm::vec3& v0 = mesh.vertices[face.indices[0]];
+		const glm::vec3& v1 = mesh.vertices[face.indices[1]];
+		const glm::vec3& v2 = mesh.vertices[face.indices[2]];
+		normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
 	}
-	else
+
+	const glm::vec3& t0 = mesh.textureCoords[face.indices[0]];
+	const glm::vec3& t1 = mesh.textureCoords[face.indices[1]];
+	const glm::vec3& t2 = mesh.textureCoords[face.indices[2]];
+
+	glm::vec3 tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+	glm::vec3 biTangent = glm::vec3(0.0f, 0.0f, 0.0f);
+
+	if (face.indices.size() >= 4)
 	{
-		if (node->bound.IntersectRay(ray))
-		{
-			HitInfo leftHitInfo;
-			HitInfo rightHitInfo;
-			bool hitLeft = TraceBVHNode(ray, leftHitInfo, hitSide, mesh, node->left);
-			bool hitRight = TraceBVHNode(ray, rightHitInfo, hitSide, mesh, node->right);
-
-			if (hitLeft && hitRight) {
-				if (leftHitInfo.z < rightHitInfo.z)
-				{
-					hInfo.Copy(leftHitInfo);
-				}
-				else
-				{
-					hInfo.Copy(rightHitInfo);
-				}
-				return true;
-			}
-			else if (hitLeft)
-			{
-				hInfo.Copy(leftHitInfo);
-				return true;
-			}
-			else if (hitRight)
-			{
-				hInfo.Copy(rightHitInfo);
-				return true;
-			}
-			else
-			{
-				return false;
-			}
-		}
-		else
-		{
-			return false;
-		}
+		auto faceId = face.indices[3];
+		tangent = mesh.tangents[faceId];
+		biTangent = mesh.bitangents[faceId];
 	}
+	glm::vec3 tex = beta0 * t0 + beta1 * t1 + beta2 * t2;
+
+	hInfo.p = p;
+	hInfo.z = hit.t;
+	hInfo.N = hit.front ? Vec3f(normal.x, normal.y, normal.z) : -1.0f * Vec3f(normal.x, normal.y, normal.z);
+	hInfo.front = hit.front;
+	hInfo.uvw = Vec3f(tex.x, tex.y, tex.z);
+	hInfo.Tangent = Vec3f(tangent.x, tangent.y, tangent.z);
+	hInfo.Bitangent = Vec3f(biTangent.x, biTangent.y, biTangent.z);
 }
 
-bool Model::TraceBVHNode(RayContext& rayContext, HitInfoContext& hInfoContext, int hitSide, Mesh& mesh, BVHNode* node) const
+void Model::FillHitInfo(RayContext& rayContext, TriangleHit const& hit, HitInfoContext& hInfoContext, Mesh& mesh) const
 {
 	HitInfo& hInfo = hInfoContext.mainHitInfo;
-	HitInfo& hInfoRight = hInfoContext.rightHitInfo;
-	HitInfo& hInfoTop = hInfoContext.topHitInfo;
+	FillHitInfo(rayContext.cameraRay, hit, hInfo, mesh);
+
+	const Ray& rightRay = rayContext.rightRay;
+	const Ray& topRay = rayContext.topRay;
+
+	HitInfo& rightInfo = hInfoContext.rightHitInfo;
+	HitInfo& topInfo = hInfoContext.topHitInfo;
+
+	const auto N = hInfo.N.GetNormalized();
+
+	const auto zRight = (rightRay.p - hInfo.p).Dot(N);
+	const auto tRight = zRight / (rightRay.dir.Dot(N));
+	const auto pRight = rightRay.p + tRight * rightRay.dir;
 
-	if (node->IsLeaf())
+	const auto zTop = (topRay.p - hInfo.p).Dot(N);
+	const auto tTop = zTop / (topRay.dir.Dot(N));
+	const auto pTop = topRay.p + tTop * topRay.dir;
+
+	rightInfo.N = N;
+	rightInfo.z = tRight;
+	rightInfo.p = pRight;
+
+	topInfo.N = N;
+	topInfo.z = tTop;
+	topInfo.p = pTop;
+
+	if (!rayContext.hasDiff)
 	{
-		bool result = false;
-		for (unsigned i = 0; i < node->faceList.size(); i++)
-		{
-			unsigned faceId = node->faceList[i];
+		hInfo.duvw[0] = Vec3f(0.0f, 0.0f, 0.0f);
+		hInfo.duvw[1] = Vec3f(0.0f, 0.0f, 0.0f);
+		return;
+	}
 
-			HitInfoContext currentHitInfoContext;
-			HitInfo& currentHitInfo = currentHitInfoContext.mainHitInfo;
+	const Face& face = mesh.faces[hit.faceId];
+	const glm::vec3& glmT0 = mesh.textureCoords[face.indices[0]];
+	const glm::vec3& glmT1 = mesh.textureCoords[face.indices[1]];
+	const glm::vec3& glmT2 = mesh.textureCoords[face.indices[2]];
 
-			if (IntersectRayWithFace(rayContext, currentHitInfoContext, hitSide, mesh, mesh.faces[faceId]))
-			{
-				if (currentHitInfo.z < hInfo.z)
-				{
-					result = true;
+	Vec3f t0(glmT0.x, glmT0.y, glmT0.z);
+	Vec3f t1(glmT1.x, glmT1.y, glmT1.z);
+	Vec3f t2(glmT2.x, glmT2.y, glmT2.z);
 
-					hInfo.Copy(currentHitInfo);
+	// texture coordinates where the offset rays cross the triangle's plane
+	const PrecomputedTriangle& triangle = mesh.bvh->GetTriangles()[hit.slot];
+	float u, v;
 
-					hInfoRight.CopyForDiffRay(currentHitInfoContext.rightHitInfo);
-					hInfoTop.CopyForDiffRay(currentHitInfoContext.topHitInfo);
-				}
-			}
-		}
-		return result;
+	Vec3f texRight = hInfo.uvw;
+	if (triangle.PlaneBarycentric(rightRay, u, v))
+	{
+		texRight = (1.0f - u - v) * t0 + u * t1 + v * t2;
 	}
-	else
+
+	Vec3f texTop = hInfo.uvw;
+	if (triangle.PlaneBarycentric(topRay, u, v))
 	{
-		const auto ray = rayContext.cameraRay;
+		texTop = (1.0f - u - v) * t0 + u * t1 + v * t2;
+	}
 
-		if (node->bound.IntersectRay(ray))
-		{
-			HitInfoContext leftHitInfoContext;
-			HitInfo& leftHitInfo = leftHitInfoContext.mainHitInfo;
-			HitInfo& left_RightHitInfo = leftHitInfoContext.rightHitInfo;
-			HitInfo& left_TopHitInfo = leftHitInfoContext.topHitInfo;
-
-			HitInfoContext rightHitInfoContext;
-			HitInfo& rightHitInfo = rightHitInfoContext.mainHitInfo;
-			HitInfo& right_RightHitInfo = rightHitInfoContext.rightHitInfo;
-			HitInfo& right_TopHitInfo = rightHitInfoContext.topHitInfo;
-
-			bool hitLeft = TraceBVHNode(rayContext, leftHitInfoContext, hitSide, mesh, node->left);
-			bool hitRight = TraceBVHNode(rayContext, rightHitInfoContext, hitSide, mesh, node->right);
-
-			if (hitLeft && hitRight) {
-				if (leftHitInfo.z < rightHitInfo.z)
-				{
-					hInfo.Copy(leftHitInfo);
-
-					hInfoRight.CopyForDiffRay(left_RightHitInfo);
-					hInfoTop.CopyForDiffRay(left_TopHitInfo);
-				}
-				else
-				{
-					hInfo.Copy(rightHitInfo);
-
-					hInfoRight.CopyForDiffRay(right_RightHitInfo);
-					hInfoTop.CopyForDiffRay(right_TopHitInfo);
-				}
-				return true;
-			}
-			else if (hitLeft)
-			{
-				hInfo.Copy(leftHitInfo);
-
-				hInfoRight.CopyForDiffRay(left_RightHitInfo);
-				hInfoTop.CopyForDiffRay(left_TopHitInfo);
-
-				return true;
-			}
-			else if (hitRight)
-			{
-				hInfo.Copy(rightHitInfo);
-
-				hInfoRight.CopyForDiffRay(right_RightHitInfo);
-				hInfoTop.CopyForDiffRay(right_TopHitInfo);
-
-				return true;
-			}
-			else
-			{
-				return false;
-			}
-		}
-		else
-		{
-			return false;
-		}
+	hInfo.duvw[0] = (texRight - hInfo.uvw) / rayContext.delta;
+	hInfo.duvw[1] = (texTop - hInfo.uvw) / rayContext.delta;
+}
+
+bool Model::TraceBVH(Ray const& ray, HitInfo& hInfo, int hitSide, Mesh& mesh) const
+{
+	TriangleHit closest;
+	if (!mesh.bvh->Intersect(ray, hitSide, hInfo.z, closest))
+	{
+		return false;
 	}
+
+	FillHitInfo(ray, closest, hInfo, mesh);
+	return true;
+}
+
+bool Model::TraceBVH(RayContext& rayContext, HitInfoContext& hInfoContext, int hitSide, Mesh& mesh) const
+{
+	TriangleHit closest;
+	if (!mesh.bvh->Intersect(rayContext.cameraRay, hitSide, hInfoContext.mainHitInfo.z, closest))
+	{
+		return false;
+	}
+
+	FillHitInfo(rayContext, closest, hInfoContext, mesh);
+	return true;
 }
 
 bool Model::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const
@@ -179,29 +155,10 @@ bool Model::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const
 			continue;
 		}
 
-		HitInfo currentHitInfo;
-		if (TraceBVHNode(ray, currentHitInfo, hitSide, mesh, mesh.bvh->GetRoot()))
+		if (TraceBVH(ray, hInfo, hitSide, mesh))
 		{
-			if (currentHitInfo.z < hInfo.z)
-			{
-				result = true;
-				hInfo.Copy(currentHitInfo);
-			}
+			result = true;
 		}
-
-		/*	for (int j = 0; j < mesh.faces.size(); j++)
-			{
-				auto face = mesh.faces[j];
-				HitInfo currentHitInfo;
-				if (IntersectRayWithFace(ray, currentHitInfo, hitSide, mesh, face))
-				{
-					if (currentHitInfo.z < hInfo.z)
-					{
-						result = true;
-						hInfo.Copy(currentHitInfo);
-					}
-				}
-			}*/
 	}
 
 	return result;
@@ -216,10 +173,6 @@ bool Model::IntersectRay(RayContext& rayContext, HitInfoContext& hInfoContext, i
 
 	bool result = false;
 
-	HitInfo& hInfo = hInfoContext.mainHitInfo;
-	HitInfo& hInfoRight = hInfoContext.rightHitInfo;
-	HitInfo& hInfoTop = hInfoContext.topHitInfo;
-
 	for (int i = 0; i < meshesNum; i++)
 	{
 		auto& mesh = meshes[i];
@@ -229,19 +182,37 @@ bool Model::IntersectRay(RayContext& rayContext, HitInfoContext& hInfoContext, i
 			continue;
 		}
 
-		HitInfoContext currentHitInfoContext;
-		HitInfo& currentHitInfo = currentHitInfoContext.mainHitInfo;
-
-		if (TraceBVHNode(rayContext, currentHitInfoContext, hitSide, mesh, mesh.bvh->GetRoot()))
+		if (TraceBVH(rayContext, hInfoContext, hitSide, mesh))
 		{
-			if (currentHitInfo.z < hInfo.z)
-			{
-				result = true;
-				hInfo.Copy(currentHitInfo);
-				hInfoRight.CopyForDiffRay(currentHitInfoContext.rightHitInfo);
-				hInfoTop.CopyForDiffRay(currentHitInfoContext.topHitInfo);
-			}
+			result = true;
 		}
 	}
 	return result;
-}
\ No newline at end of file
+}
+
+bool Model::Occluded(Ray const& ray, float tMin, float tMax, int hitSide) const
+{
+	if (!GetBoundBox().IntersectRay(ray, tMax))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < meshesNum; i++)
+	{
+		auto& mesh = meshes[i];
+
+		if (!mesh.aabb.IntersectRay(ray, tMax))
+		{
+			continue;
+		}
+
+		bool occluded = mesh.bvh->Occluded(ray, hitSide, tMin, tMax);
+
+		if (occluded)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
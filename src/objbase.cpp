@@ -1,13 +1,36 @@
 #include "objbase.h"
 #include "node.h"
 #include "hitinfo.h"
+#include "rng.h"
 
-Interaction Object::Sample() const 
+Interaction Object::Sample(SamplerContext&) const
 {
 	Interaction it = Interaction();
 	return it;
 };
 
+Interaction Object::SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const
+{
+	Interaction it = Sample(sampler);
+	pdf = SolidAnglePdf(ref, it);
+	return it;
+}
+
+float Object::SolidAnglePdf(const Vec3f& ref, const Interaction& it) const
+{
+	float area = Area();
+	if (area <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// area density times distance squared over the cosine at the surface
+	Vec3f toRef = ref - it.p;
+	float distanceSquare = toRef.LengthSquared();
+	float cosTheta = toRef.GetNormalized().Dot(it.n);
+	return distanceSquare / (area * (cosTheta > 0.0001f ? cosTheta : 0.0001f));
+}
+
 void Object::TransformInteractionToWorld(Interaction& it) const
 {
 	it.p = parent->TransformPointToWorld(it.p);
@@ -3,169 +3,35 @@
 #include "bvh.h"
 #include "GLFW/glfw3.h"
 #include "float.h"
+#include "rng.h"
+#include "utils.h"
 #include <math.h>
 
 extern float buildTime;
 extern Camera camera;
 
-bool TriObj::TraceBVHNode( Ray const &ray, HitInfo &hInfo, int hitSide, BVHNode* node) const
+bool TriObj::TraceBVH( Ray const &ray, HitInfo &hInfo, int hitSide) const
 {
-    if(node->IsLeaf())
+    TriangleHit closest;
+    if(!bvh->Intersect(ray, hitSide, hInfo.z, closest))
     {
-        bool result = false;
-        for(unsigned i = 0; i < node->faceList.size(); i++)
-        {
-            unsigned faceId = node->faceList[i];
-            HitInfo currentHitInfo;
-            if(IntersectTriangle(ray, currentHitInfo, hitSide, faceId))
-            {
-                if(currentHitInfo.z < hInfo.z)
-                {
-                    result = true;
-                    
-                    hInfo.Copy(currentHitInfo);
-                }
-            }
-        }
-        return result;
-    }
-    else
-    {
-        if(node->bound.IntersectRay(ray))
-        {
-            HitInfo leftHitInfo;
-            HitInfo rightHitInfo;
-            bool hitLeft = TraceBVHNode(ray, leftHitInfo, hitSide, node->left);
-            bool hitRight = TraceBVHNode(ray, rightHitInfo, hitSide, node->right);
-            
-            if (hitLeft && hitRight) {
-                if (leftHitInfo.z < rightHitInfo.z)
-                {
-                    hInfo.Copy(leftHitInfo);
-                }
-                else
-                {
-                    hInfo.Copy(rightHitInfo);
-                }
-                return true;
-            }
-            else if (hitLeft)
-            {
-                hInfo.Copy(leftHitInfo);
-                return true;
-            }
-            else if (hitRight)
-            {
-                hInfo.Copy(rightHitInfo);
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
-        else
-        {
-            return false;
-        }
+        return false;
     }
+    
+    FillHitInfo(ray, closest, hInfo);
+    return true;
 }
 
-bool TriObj::TraceBVHNode( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide, BVHNode* node) const
+bool TriObj::TraceBVH( RayContext &rayContext, HitInfoContext& hInfoContext, int hitSide) const
 {
-    HitInfo& hInfo = hInfoContext.mainHitInfo;
-    HitInfo& hInfoRight = hInfoContext.rightHitInfo;
-    HitInfo& hInfoTop =hInfoContext.topHitInfo;
-    
-    if(node->IsLeaf())
-    {
-        bool result = false;
-        for(unsigned i = 0; i < node->faceList.size(); i++)
-        {
-            unsigned faceId = node->faceList[i];
-            
-            HitInfoContext currentHitInfoContext;
-            HitInfo& currentHitInfo = currentHitInfoContext.mainHitInfo;
-            
-            if(IntersectTriangle(rayContext, currentHitInfoContext, hitSide, faceId))
-            {
-                if(currentHitInfo.z < hInfo.z)
-                {
-                    result = true;
-                    
-                    hInfo.Copy(currentHitInfo);
-                    
-                    hInfoRight.CopyForDiffRay(currentHitInfoContext.rightHitInfo);
-                    hInfoTop.CopyForDiffRay(currentHitInfoContext.topHitInfo);
-                }
-            }
-        }
-        return result;
-    }
-    else
+    TriangleHit closest;
+    if(!bvh->Intersect(rayContext.cameraRay, hitSide, hInfoContext.mainHitInfo.z, closest))
     {
-        const auto ray = rayContext.cameraRay;
-        
-        if(node->bound.IntersectRay(ray))
-        {
-            HitInfoContext leftHitInfoContext;
-            HitInfo& leftHitInfo = leftHitInfoContext.mainHitInfo;
-            HitInfo& left_RightHitInfo = leftHitInfoContext.rightHitInfo;
-            HitInfo& left_TopHitInfo = leftHitInfoContext.topHitInfo;
-            
-            HitInfoContext rightHitInfoContext;
-            HitInfo& rightHitInfo = rightHitInfoContext.mainHitInfo;
-            HitInfo& right_RightHitInfo = rightHitInfoContext.rightHitInfo;
-            HitInfo& right_TopHitInfo = rightHitInfoContext.topHitInfo;
-            
-            bool hitLeft = TraceBVHNode(rayContext, leftHitInfoContext, hitSide, node->left);
-            bool hitRight = TraceBVHNode(rayContext, rightHitInfoContext, hitSide, node->right);
-            
-            if (hitLeft && hitRight) {
-                if (leftHitInfo.z < rightHitInfo.z)
-                {
-                    hInfo.Copy(leftHitInfo);
-
-                    hInfoRight.CopyForDiffRay(left_RightHitInfo);
-                    hInfoTop.CopyForDiffRay(left_TopHitInfo);
-                }
-                else
-                {
-                    hInfo.Copy(rightHitInfo);
-
-                    hInfoRight.CopyForDiffRay(right_RightHitInfo);
-                    hInfoTop.CopyForDiffRay(right_TopHitInfo);
-                }
-                return true;
-            }
-            else if (hitLeft)
-            {
-                hInfo.Copy(leftHitInfo);
-
-                hInfoRight.CopyForDiffRay(left_RightHitInfo);
-                hInfoTop.CopyForDiffRay(left_TopHitInfo);
-                
-                return true;
-            }
-            else if (hitRight)
-            {
-                hInfo.Copy(rightHitInfo);
-
-                hInfoRight.CopyForDiffRay(right_RightHitInfo);
-                hInfoTop.CopyForDiffRay(right_TopHitInfo);
-                
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
-        else
-        {
-            return false;
-        }
+        return false;
     }
+    
+    FillHitInfo(rayContext, closest, hInfoContext);
+    return true;
 }
 
 
@@ -176,7 +42,7 @@ bool TriObj::IntersectRay(const Ray &ray, HitInfo &hInfo, int hitSide) const
         return false;
     }
 
-    return TraceBVHNode(ray, hInfo, hitSide, bvh->GetRoot());
+    return TraceBVH(ray, hInfo, hitSide);
 }
 
 bool TriObj::IntersectRay(RayContext &rayContext, HitInfoContext &hInfoContext, int hitSide) const
@@ -186,7 +52,12 @@ bool TriObj::IntersectRay(RayContext &rayContext, HitInfoContext &hInfoContext,
         return false;
     }
     
-    return TraceBVHNode(rayContext, hInfoContext, hitSide, bvh->GetRoot());
+    return TraceBVH(rayContext, hInfoContext, hitSide);
+}
+
+bool TriObj::Occluded(Ray const &ray, float tMin, float tMax, int hitSide) const
+{
+    return bvh->Occluded(ray, hitSide, tMin, tMax);
 }
 
 bool TriObj::Load(char const *filename, bool loadMtl)
@@ -213,252 +84,91 @@ bool TriObj::Load(char const *filename, bool loadMtl)
     return true;
 }
 
-bool TriObj::IntersectTriangle( RayContext &rayContext, HitInfoContext &hInfoContext, int hitSide, unsigned int faceID) const
-{
-    HitInfo& hInfo = hInfoContext.mainHitInfo;
-    
-    if(IntersectTriangle(rayContext.cameraRay, hInfo, hitSide, faceID))
-    {
-        if(rayContext.hasDiff)
-        {
-            const TriFace& face = F(faceID);
-            
-            const Vec3f& v0 = V(face.v[0]);
-            const Vec3f& v1 = V(face.v[1]);
-            const Vec3f& v2 = V(face.v[2]);
-            
-            Vec3f v01 = v1 - v0;
-            Vec3f v02 = v2 - v0;
-            
-            const Ray& rightRay = rayContext.rightRay;
-            const Ray& topRay = rayContext.topRay;
-            
-            HitInfo& rightInfo = hInfoContext.rightHitInfo;
-            HitInfo& topInfo = hInfoContext.topHitInfo;
-            
-            const auto N = hInfo.N.GetNormalized();
-            
-            const auto zRight = (rightRay.p - hInfo.p).Dot(N);
-            const auto tRight = zRight / (rightRay.dir.Dot(N));
-            const auto pRight = rightRay.p + tRight * rightRay.dir;
-            const auto nRight = N;
-            
-            const auto zTop = (topRay.p - hInfo.p).Dot(N);
-            const auto tTop = zTop / (topRay.dir.Dot(N));
-            const auto pTop = topRay.p + tTop * topRay.dir;
-            const auto nTop = N;
-            
-            assert(!isnan(nTop.x));
-            assert(!isnan(nRight.x));
-            
-            rightInfo.N = nRight;
-            rightInfo.z = tRight;
-            rightInfo.p = pRight;
-            
-            topInfo.N = nTop;
-            topInfo.z = tTop;
-            topInfo.p = pTop;
-            
-            Vec3f texRight;
-            {
-                Matrix3<float> mmRight = Matrix3<float>(-rightRay.dir, v01, v02);
-                mmRight.Invert();
-                
-                Vec3f vv0 = mmRight * v0;
-                Vec3f vv1 = mmRight * v1;
-                Vec3f vv2 = mmRight * v2;
-                Vec3f pp = mmRight * pRight;
-                
-                Vec2f v0_2d = Vec2f(vv0.y, vv0.z);
-                Vec2f v1_2d = Vec2f(vv1.y, vv1.z);
-                Vec2f v2_2d = Vec2f(vv2.y, vv2.z);
-                Vec2f p_2d = Vec2f(pp.y, pp.z);
-                
-                Vec2f pv0 = v0_2d - p_2d;
-                Vec2f pv1 = v1_2d - p_2d;
-                Vec2f pv2 = v2_2d - p_2d;
-                
-                float two_a0 = pv1.Cross(pv2);
-                float two_a1 = pv2.Cross(pv0);
-                float two_a2 = pv0.Cross(pv1);
-                
-                float two_a = (v1_2d - v0_2d).Cross(v2_2d - v0_2d);
-                
-                float beta0 = two_a0 / two_a;
-                float beta1 = two_a1 / two_a;
-                float beta2 = two_a2 / two_a;
-                
-                const TriFace& texFace = FT(faceID);
-                
-                const Vec3f& t0 = VT(texFace.v[0]);
-                const Vec3f& t1 = VT(texFace.v[1]);
-                const Vec3f& t2 = VT(texFace.v[2]);
-                
-                texRight = beta0 * t0 + beta1 * t1 + beta2 * t2;
-            }
-            
-            Vec3f texTop;
-            {
-                Matrix3<float> mmTop = Matrix3<float>(-topRay.dir, v01, v02);
-                mmTop.Invert();
-                
-                Vec3f vv0 = mmTop * v0;
-                Vec3f vv1 = mmTop * v1;
-                Vec3f vv2 = mmTop * v2;
-                Vec3f pp = mmTop * pTop;
-                
-                Vec2f v0_2d = Vec2f(vv0.y, vv0.z);
-                Vec2f v1_2d = Vec2f(vv1.y, vv1.z);
-                Vec2f v2_2d = Vec2f(vv2.y, vv2.z);
-                Vec2f p_2d = Vec2f(pp.y, pp.z);
-                
-                Vec2f pv0 = v0_2d - p_2d;
-                Vec2f pv1 = v1_2d - p_2d;
-                Vec2f pv2 = v2_2d - p_2d;
-                
-                float two_a0 = pv1.Cross(pv2);
-                float two_a1 = pv2.Cross(pv0);
-                float two_a2 = pv0.Cross(pv1);
-                
-                float two_a = (v1_2d - v0_2d).Cross(v2_2d - v0_2d);
-                
-                float beta0 = two_a0 / two_a;
-                float beta1 = two_a1 / two_a;
-                float beta2 = two_a2 / two_a;
-                
-                const TriFace& texFace = FT(faceID);
-                
-                const Vec3f& t0 = VT(texFace.v[0]);
-                const Vec3f& t1 = VT(texFace.v[1]);
-                const Vec3f& t2 = VT(texFace.v[2]);
-                
-                texTop = beta0 * t0 + beta1 * t1 + beta2 * t2;
-            }
-        
-            hInfo.duvw[0] = (texRight - hInfo.uvw) / rayContext.delta;
-            hInfo.duvw[1] = (texTop - hInfo.uvw) / rayContext.delta;
-        }
-        else
-        {
-            hInfo.duvw[0] = Vec3f(0.0f, 0.0f, 0.0f);
-            hInfo.duvw[1] = Vec3f(0.0f, 0.0f, 0.0f);
-        }
-        
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
-bool TriObj::IntersectTriangle( Ray const &ray, HitInfo &hInfo, int hitSide, unsigned int faceID) const
+void TriObj::FillHitInfo( Ray const &ray, TriangleHit const &hit, HitInfo &hInfo) const
 {
-    const TriFace& face = F(faceID);
+    float beta0 = 1.0f - hit.u - hit.v;
+    float beta1 = hit.u;
+    float beta2 = hit.v;
     
-    const Vec3f& v0 = V(face.v[0]);
-    const Vec3f& v1 = V(face.v[1]);
-    const Vec3f& v2 = V(face.v[2]);
+    const TriFace& normalFace = FN(hit.faceId);
     
-    Vec3f v01 = v1 - v0;
-    Vec3f v02 = v2 - v0;
+    const Vec3f& n0 = VN(normalFace.v[0]);
+    const Vec3f& n1 = VN(normalFace.v[1]);
+    const Vec3f& n2 = VN(normalFace.v[2]);
     
-    // unnormalized
-    Vec3f n = v01.Cross(v02);
+    Vec3f normal = (beta0 * n0 + beta1 * n1 + beta2 * n2).GetNormalized();
     
-    // (ray.origin + ray.dir * t - v0).dot(n) = 0
-    float dirDotN = ray.dir.Dot(n);
+    const TriFace& texFace = FT(hit.faceId);
     
-    if(abs(dirDotN) <= FLT_EPSILON)
-    {
-        return false;
-    }
+    const Vec3f& t0 = VT(texFace.v[0]);
+    const Vec3f& t1 = VT(texFace.v[1]);
+    const Vec3f& t2 = VT(texFace.v[2]);
     
-    float originDotN = ray.p.Dot(n);
-    float v0DotN = v0.Dot(n);
-    float t = (v0DotN - originDotN) / dirDotN;
+    hInfo.p = ray.p + ray.dir * hit.t;
+    hInfo.z = hit.t;
+    hInfo.N = hit.front? normal: -1.0f * normal;
+    hInfo.front = hit.front;
+    hInfo.uvw = beta0 * t0 + beta1 * t1 + beta2 * t2;
+}
+
+void TriObj::FillHitInfo( RayContext &rayContext, TriangleHit const &hit, HitInfoContext &hInfoContext) const
+{
+    HitInfo& hInfo = hInfoContext.mainHitInfo;
+    FillHitInfo(rayContext.cameraRay, hit, hInfo);
     
-    if(t < 0.0f)
+    if(!rayContext.hasDiff)
     {
-        return false;
+        hInfo.duvw[0] = Vec3f(0.0f, 0.0f, 0.0f);
+        hInfo.duvw[1] = Vec3f(0.0f, 0.0f, 0.0f);
+        return;
     }
     
-    bool isFront = (dirDotN < 0.0f);
+    const Ray& rightRay = rayContext.rightRay;
+    const Ray& topRay = rayContext.topRay;
     
-    if(hitSide == HIT_FRONT && !isFront)
-    {
-        return false;
-    }
+    HitInfo& rightInfo = hInfoContext.rightHitInfo;
+    HitInfo& topInfo = hInfoContext.topHitInfo;
     
-    if(hitSide == HIT_BACK && isFront)
-    {
-        return false;
-    }
+    const auto N = hInfo.N.GetNormalized();
     
-    Vec3f p = ray.p + ray.dir * t;
+    const auto zRight = (rightRay.p - hInfo.p).Dot(N);
+    const auto tRight = zRight / (rightRay.dir.Dot(N));
     
-    Matrix3<float> mm = Matrix3<float>(-ray.dir, v01, v02);
-    mm.Invert();
+    const auto zTop = (topRay.p - hInfo.p).Dot(N);
+    const auto tTop = zTop / (topRay.dir.Dot(N));
     
-    Vec3f vv0 = mm * v0;
-    Vec3f vv1 = mm * v1;
-    Vec3f vv2 = mm * v2;
-    Vec3f pp = mm * p;
+    rightInfo.N = N;
+    rightInfo.z = tRight;
+    rightInfo.p = rightRay.p + tRight * rightRay.dir;
     
-    Vec2f v0_2d = Vec2f(vv0.y, vv0.z);
-    Vec2f v1_2d = Vec2f(vv1.y, vv1.z);
-    Vec2f v2_2d = Vec2f(vv2.y, vv2.z);
-    Vec2f p_2d = Vec2f(pp.y, pp.z);
+    topInfo.N = N;
+    topInfo.z = tTop;
+    topInfo.p = topRay.p + tTop * topRay.dir;
     
-    Vec2f pv0 = v0_2d - p_2d;
-    Vec2f pv1 = v1_2d - p_2d;
-    Vec2f pv2 = v2_2d - p_2d;
-    
-    float two_a0 = pv1.Cross(pv2);
-    if(two_a0 <= 0.0f)
-    {
-        return false;
-    }
-    float two_a1 = pv2.Cross(pv0);
-    if(two_a1 <= 0.0f)
-    {
-        return false;
-    }
-    float two_a2 = pv0.Cross(pv1);
-    if(two_a2 <= 0.0f)
-    {
-        return false;
-    }
-    
-    float two_a = (v1_2d - v0_2d).Cross(v2_2d - v0_2d);
-    
-    float beta0 = two_a0 / two_a;
-    float beta1 = two_a1 / two_a;
-    float beta2 = two_a2 / two_a;
-    
-    const TriFace& normalFace = FN(faceID);
-    
-    const Vec3f& n0 = VN(normalFace.v[0]);
-    const Vec3f& n1 = VN(normalFace.v[1]);
-    const Vec3f& n2 = VN(normalFace.v[2]);
-    
-    Vec3f normal = (beta0 * n0 + beta1 * n1 + beta2 * n2).GetNormalized();
-    
-    const TriFace& texFace = FT(faceID);
+    const TriFace& texFace = FT(hit.faceId);
     
     const Vec3f& t0 = VT(texFace.v[0]);
     const Vec3f& t1 = VT(texFace.v[1]);
     const Vec3f& t2 = VT(texFace.v[2]);
     
-    Vec3f tex = beta0 * t0 + beta1 * t1 + beta2 * t2;
+    // texture coordinates where the offset rays cross the triangle's plane
+    const PrecomputedTriangle& triangle = bvh->GetTriangles()[hit.slot];
+    float u, v;
     
-    hInfo.p = p;
-    hInfo.z = t;
-    hInfo.N = isFront? normal: -1.0f * normal;
-    hInfo.front = isFront;
-    hInfo.uvw = tex;
+    Vec3f texRight = hInfo.uvw;
+    if(triangle.PlaneBarycentric(rightRay, u, v))
+    {
+        texRight = (1.0f - u - v) * t0 + u * t1 + v * t2;
+    }
     
-    return true;
+    Vec3f texTop = hInfo.uvw;
+    if(triangle.PlaneBarycentric(topRay, u, v))
+    {
+        texTop = (1.0f - u - v) * t0 + u * t1 + v * t2;
+    }
+    
+    hInfo.duvw[0] = (texRight - hInfo.uvw) / rayContext.delta;
+    hInfo.duvw[1] = (texTop - hInfo.uvw) / rayContext.delta;
 }
 
 void TriObj::ViewportDisplay(const Material *mtl) const
@@ -471,11 +181,12 @@ Vec3f PlaneCalculatePlaneTexCoord(const Vec3f &p)
     return p * 0.5f + Vec3f(0.5f, 0.5f, 0.0f);
 };
 
-Interaction Plane::Sample() const
+Interaction Plane::Sample(SamplerContext& sampler) const
 {
 	Interaction result;
-	float x = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* 2.0f - 1.0f;
-	float y = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * 2.0f - 1.0f;
+	Vec2f u = sampler.Next2D();
+	float x = u.x * 2.0f - 1.0f;
+	float y = u.y * 2.0f - 1.0f;
 	
 	result.p =Vec3f(x, y, 0.0f);
 	result.n = Vec3f(0.0f, 0.0f, 1.0f);
@@ -493,6 +204,149 @@ Vec3f Plane::Normal(const Vec3f& p) const
 	return (up - zero).GetNormalized();
 }
 
+namespace
+{
+	// Solid angles outside this range are sampled by area instead, tiny ones lose all precision and
+	// the parametrization breaks down when the rectangle covers nearly the whole hemisphere.
+	const float MinSphericalSampleArea = 3e-4f;
+	const float MaxSphericalSampleArea = 6.22f;
+	// sin^2 of 1.5 degrees, smaller cones are sampled with a Taylor expansion
+	const float SmallConeSin2 = 0.00068523f;
+
+	float SafeSqrt(float x)
+	{
+		return sqrtf(x > 0.0f ? x : 0.0f);
+	}
+
+	float Clamp(float x, float low, float high)
+	{
+		return x < low ? low : (x > high ? high : x);
+	}
+
+	// Urena et al., "An Area-Preserving Parametrization for Spherical Rectangles" (2013).
+	// The rectangle s + [0, 1] ex + [0, 1] ey is projected onto the unit sphere around ref.
+	struct SphericalRectangle
+	{
+		bool Init(const Vec3f& _ref, const Vec3f& s, const Vec3f& ex, const Vec3f& ey)
+		{
+			ref = _ref;
+			float exLength = ex.Length();
+			float eyLength = ey.Length();
+			if (exLength <= 0.0f || eyLength <= 0.0f || fabsf(ex.Dot(ey)) > 1e-4f * exLength * eyLength)
+			{
+				return false;
+			}
+
+			x = ex / exLength;
+			y = ey / eyLength;
+			z = x.Cross(y);
+
+			// z points away from the rectangle
+			Vec3f d = s - ref;
+			z0 = d.Dot(z);
+			if (z0 > 0.0f)
+			{
+				z = -z;
+				z0 = -z0;
+			}
+			x0 = d.Dot(x);
+			y0 = d.Dot(y);
+			x1 = x0 + exLength;
+			y1 = y0 + eyLength;
+
+			// normals of the planes through ref and each edge, and the angles between them
+			Vec3f v00(x0, y0, z0);
+			Vec3f v01(x0, y1, z0);
+			Vec3f v10(x1, y0, z0);
+			Vec3f v11(x1, y1, z0);
+			Vec3f n0 = v00.Cross(v10).GetNormalized();
+			Vec3f n1 = v10.Cross(v11).GetNormalized();
+			Vec3f n2 = v11.Cross(v01).GetNormalized();
+			Vec3f n3 = v01.Cross(v00).GetNormalized();
+			float g0 = acosf(Clamp(-n0.Dot(n1), -1.0f, 1.0f));
+			float g1 = acosf(Clamp(-n1.Dot(n2), -1.0f, 1.0f));
+			float g2 = acosf(Clamp(-n2.Dot(n3), -1.0f, 1.0f));
+			float g3 = acosf(Clamp(-n3.Dot(n0), -1.0f, 1.0f));
+
+			b0 = n0.z;
+			b1 = n2.z;
+			k = 2.0f * PI - g2 - g3;
+			solidAngle = (float)((double)g0 + (double)g1 + (double)g2 + (double)g3 - 2.0 * PI);
+			return z0 < 0.0f && solidAngle >= MinSphericalSampleArea && solidAngle <= MaxSphericalSampleArea;
+		}
+
+		Vec3f Sample(Vec2f u) const
+		{
+			// the column, from the area of the part left of it
+			float au = u.x * solidAngle + k;
+			float fu = (cosf(au) * b0 - b1) / sinf(au);
+			float cu = copysignf(1.0f / sqrtf(fu * fu + b0 * b0), fu);
+			cu = Clamp(cu, -0x1.fffffep-1f, 0x1.fffffep-1f);
+			float xu = Clamp(-(cu * z0) / SafeSqrt(1.0f - cu * cu), x0, x1);
+
+			// the height within the column, uniform in solid angle
+			float d = sqrtf(xu * xu + z0 * z0);
+			float h0 = y0 / sqrtf(d * d + y0 * y0);
+			float h1 = y1 / sqrtf(d * d + y1 * y1);
+			float hv = h0 + u.y * (h1 - h0);
+			float hv2 = hv * hv;
+			float yv = hv2 < 1.0f - 1e-6f ? (hv * d) / sqrtf(1.0f - hv2) : y1;
+
+			return ref + x * xu + y * yv + z * z0;
+		}
+
+		Vec3f ref;
+		Vec3f x, y, z;
+		float x0, y0, z0, x1, y1;
+		float b0, b1, k;
+		float solidAngle;
+	};
+
+	// the unit square of a plane in world space, as the corner and the two edges
+	void PlaneRectangle(Node* parent, Vec3f& s, Vec3f& ex, Vec3f& ey)
+	{
+		s = parent->TransformPointToWorld(Vec3f(-1.0f, -1.0f, 0.0f));
+		ex = parent->TransformPointToWorld(Vec3f(1.0f, -1.0f, 0.0f)) - s;
+		ey = parent->TransformPointToWorld(Vec3f(-1.0f, 1.0f, 0.0f)) - s;
+	}
+}
+
+Interaction Plane::SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const
+{
+	Vec3f s, ex, ey;
+	PlaneRectangle(parent, s, ex, ey);
+	SphericalRectangle rectangle;
+	if (!rectangle.Init(ref, s, ex, ey))
+	{
+		return Object::SampleSolidAngle(ref, sampler, pdf);
+	}
+
+	Interaction result;
+	result.p = rectangle.Sample(sampler.Next2D());
+	result.n = Normal(result.p);
+	pdf = 1.0f / rectangle.solidAngle;
+	return result;
+}
+
+float Plane::SolidAnglePdf(const Vec3f& ref, const Interaction& it) const
+{
+	Vec3f s, ex, ey;
+	PlaneRectangle(parent, s, ex, ey);
+	SphericalRectangle rectangle;
+	if (!rectangle.Init(ref, s, ex, ey))
+	{
+		return Object::SolidAnglePdf(ref, it);
+	}
+	return 1.0f / rectangle.solidAngle;
+}
+
+bool Plane::NormalBounds(Vec3f& axis, float& cosTheta) const
+{
+	axis = Normal(Vec3f(0.0f, 0.0f, 0.0f));
+	cosTheta = 1.0f;
+	return true;
+}
+
 float Plane::Area() const
 {
 	Vec3f zero = parent->TransformPointToWorld(Vec3f(0.0f, 0.0f, 0.0f));
@@ -613,6 +467,30 @@ bool Plane::IntersectRay(Ray const &ray, HitInfo &hInfo, int hitSide) const
     return true;
 }
 
+bool Plane::Occluded(Ray const &ray, float tMin, float tMax, int hitSide) const
+{
+    float dirDotN = ray.dir.z;
+    
+    if(abs(dirDotN) < 0.000001f)
+    {
+        return false;
+    }
+    
+    bool isFront = (dirDotN < 0.0f);
+    if((isFront && !(hitSide & HIT_FRONT)) || (!isFront && !(hitSide & HIT_BACK)))
+    {
+        return false;
+    }
+    
+    float t = -1.0f * (ray.p.z / dirDotN);
+    if(t <= tMin || t >= tMax)
+    {
+        return false;
+    }
+    
+    return abs(ray.p.x + ray.dir.x * t) < 1.0f && abs(ray.p.y + ray.dir.y * t) < 1.0f;
+}
+
 void Plane::ViewportDisplay(const Material *mtl) const
 {
     
@@ -794,7 +672,113 @@ bool Sphere::IntersectRay(Ray const &ray, HitInfo &hInfo, int hitSide) const
     }
 }
 
+bool Sphere::Occluded(Ray const &ray, float tMin, float tMax, int hitSide) const
+{
+    float a = ray.dir.LengthSquared();
+    float b = 2 * ray.p.Dot(ray.dir);
+    float c = ray.p.LengthSquared() - 1;
+    
+    float delta = b*b - 4 * a * c;
+    if(delta < 0)
+    {
+        return false;
+    }
+    
+    float sqrtDelta = sqrtf(delta);
+    // the near root enters the sphere through the front side, the far one leaves through the back side
+    float dist1 = (-1.0f * b - sqrtDelta)/(2.0f * a);
+    float dist2 = (-1.0f * b + sqrtDelta)/(2.0f * a);
+    
+    if((hitSide & HIT_FRONT) && dist1 >= 0.0f && dist1 > tMin && dist1 < tMax)
+    {
+        return true;
+    }
+    
+    return (hitSide & HIT_BACK) && dist2 > tMin && dist2 < tMax;
+}
+
 void Sphere::ViewportDisplay(const Material *mtl) const
 {
 }
+
+Interaction Sphere::Sample(SamplerContext& sampler) const
+{
+	Vec2f u = sampler.Next2D();
+	float z = 1.0f - 2.0f * u.x;
+	float r = SafeSqrt(1.0f - z * z);
+	float phi = TWO_PI * u.y;
+
+	Interaction result;
+	result.p = Vec3f(r * cosf(phi), r * sinf(phi), z);
+	result.n = result.p;
+
+	TransformInteractionToWorld(result);
+
+	return result;
+}
+
+float Sphere::Area() const
+{
+	Vec3f center = parent->TransformPointToWorld(Vec3f(0.0f, 0.0f, 0.0f));
+	float radius = (parent->TransformPointToWorld(Vec3f(1.0f, 0.0f, 0.0f)) - center).Length();
+	return 2.0f * TWO_PI * radius * radius;
+}
+
+Interaction Sphere::SampleSolidAngle(const Vec3f& ref, SamplerContext& sampler, float& pdf) const
+{
+	Vec3f center = parent->TransformPointToWorld(Vec3f(0.0f, 0.0f, 0.0f));
+	float radius = (parent->TransformPointToWorld(Vec3f(1.0f, 0.0f, 0.0f)) - center).Length();
+	Vec3f toCenter = center - ref;
+	float distance = toCenter.Length();
+	if (distance <= radius)
+	{
+		return Object::SampleSolidAngle(ref, sampler, pdf);
+	}
+
+	// direction within the cone, then the point on the sphere it hits first
+	Vec2f u = sampler.Next2D();
+	float sinThetaMax = radius / distance;
+	float sin2ThetaMax = sinThetaMax * sinThetaMax;
+	float cosThetaMax = SafeSqrt(1.0f - sin2ThetaMax);
+	float oneMinusCosThetaMax = 1.0f - cosThetaMax;
+	float cosTheta = (cosThetaMax - 1.0f) * u.x + 1.0f;
+	float sin2Theta = 1.0f - cosTheta * cosTheta;
+	if (sin2ThetaMax < SmallConeSin2)
+	{
+		sin2Theta = sin2ThetaMax * u.x;
+		cosTheta = sqrtf(1.0f - sin2Theta);
+		oneMinusCosThetaMax = sin2ThetaMax / 2.0f;
+	}
+
+	// angle at the center between the direction to ref and the surface point
+	float cosAlpha = sin2Theta / sinThetaMax + cosTheta * SafeSqrt(1.0f - sin2Theta / sin2ThetaMax);
+	float sinAlpha = SafeSqrt(1.0f - cosAlpha * cosAlpha);
+	float phi = TWO_PI * u.y;
+
+	Vec3f w = toCenter / distance;
+	Vec3f b1, b2;
+	BranchlessONB(w, b1, b2);
+	Vec3f n = -(b1 * (sinAlpha * cosf(phi)) + b2 * (sinAlpha * sinf(phi)) + w * cosAlpha);
+
+	Interaction result;
+	result.p = center + n * radius;
+	result.n = n;
+	pdf = 1.0f / (TWO_PI * oneMinusCosThetaMax);
+	return result;
+}
+
+float Sphere::SolidAnglePdf(const Vec3f& ref, const Interaction& it) const
+{
+	Vec3f center = parent->TransformPointToWorld(Vec3f(0.0f, 0.0f, 0.0f));
+	float radius = (parent->TransformPointToWorld(Vec3f(1.0f, 0.0f, 0.0f)) - center).Length();
+	float distance = (center - ref).Length();
+	if (distance <= radius)
+	{
+		return Object::SolidAnglePdf(ref, it);
+	}
+
+	float sin2ThetaMax = radius * radius / (distance * distance);
+	float oneMinusCosThetaMax = sin2ThetaMax < SmallConeSin2 ? sin2ThetaMax / 2.0f : 1.0f - SafeSqrt(1.0f - sin2ThetaMax);
+	return 1.0f / (TWO_PI * oneMinusCosThetaMax);
+}
     
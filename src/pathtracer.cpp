@@ -4,107 +4,240 @@
 #include <atomic>
 #include "spdlog/spdlog.h"
 #include "render.h"
+#include "film.h"
 
 extern Node rootNode;
 extern RenderImage renderImage;
+extern Film film;
 extern Color24* normalPixels;
 extern std::atomic<bool> outputing;
 
-void PathTracer::Init(unsigned int _width, unsigned int _height)
+void PathTracer::Init(unsigned int _width, unsigned int _height, const RenderSettings& _settings)
 {
 	width = _width;
 	height = _height;
 	size = width * height;
-	haltonSampler = new HaltonSampler();
+	settings = _settings;
 
-	pixelData.resize(size);
+	film.Clear();
+	converged.assign(size, false);
+	resumedPassCount = 0;
+	if (settings.resume && !settings.checkpointPath.empty() && !ResumeFromCheckpoint())
+	{
+		spdlog::warn("no usable checkpoint in {}, starting from scratch", settings.checkpointPath);
+	}
 }
 
-void PathTracer::Run()
+bool PathTracer::ResumeFromCheckpoint()
 {
-	std::size_t cores =
-		//1;
-		 std::thread::hardware_concurrency() - 1;
+	Film::CheckpointInfo info;
+	info.sceneHash = settings.sceneHash;
+	if (!film.LoadCheckpoint(settings.checkpointPath, info))
+	{
+		film.Clear();
+		return false;
+	}
 
-	for (std::size_t i = 0; i < cores; i++)
+	// the samples still to come have to continue the same sequences
+	if (info.seed != settings.seed || info.samplerType != (uint32_t)settings.sampler)
 	{
-		auto worker = new RenderWorker(i, cores, this);
-		// worker->Run();
-		workers.push_back(worker);
+		spdlog::info("continuing with the checkpoint's seed {} and sampler", info.seed);
+		settings.seed = info.seed;
+		settings.sampler = (SamplerType)info.samplerType;
 	}
+	resumedPassCount = info.passCount;
+	spdlog::info("resumed {} from pass {}", settings.checkpointPath, resumedPassCount);
+	return true;
 }
 
-void PathTracer::Join()
+bool PathTracer::SaveCheckpoint(unsigned int passCount)
 {
-	for (int i = 0; i < workers.size(); i++)
+	Film::CheckpointInfo info;
+	info.passCount = passCount;
+	info.samplerType = (uint32_t)settings.sampler;
+	info.seed = settings.seed;
+	info.sceneHash = settings.sceneHash;
+
+	auto start = std::chrono::steady_clock::now();
+	if (!film.SaveCheckpoint(settings.checkpointPath, info))
 	{
-		workers[i]->Join();
+		spdlog::warn("failed to write checkpoint {}", settings.checkpointPath);
+		return false;
 	}
+	lastCheckpoint = std::chrono::steady_clock::now();
+	spdlog::info("checkpoint {} at pass {}, {}s", settings.checkpointPath, passCount, std::chrono::duration<float>(lastCheckpoint - start).count());
+	return true;
 }
 
-void RenderWorker::Join()
+bool PathTracer::EndPass(unsigned int passCount)
 {
-	thread->join();
+	bool stop = false;
+	if (outputing.load())
+	{
+		spdlog::info("Worker Break!");
+		stop = true;
+	}
+	else if (settings.samplesPerPixel > 0 && passCount >= settings.samplesPerPixel)
+	{
+		stop = true;
+	}
+	else if (settings.adaptiveThreshold > 0.0f && passCount >= settings.minSampleCount && !UpdateConvergence())
+	{
+		spdlog::info("converged after {} passes", passCount);
+		stop = true;
+	}
+	else
+	{
+		stop = settings.timeBudget > 0.0f && std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count() >= settings.timeBudget;
+	}
+
+	if (!settings.checkpointPath.empty()
+		&& (stop || std::chrono::duration<float>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= settings.checkpointInterval))
+	{
+		SaveCheckpoint(passCount);
+	}
+	return stop;
 }
 
-RenderWorker::RenderWorker(int _index, int _cores, PathTracer* _render)
+void PathTracer::Run()
 {
-	originalIndex = _index;
-	cores = _cores;
-	
-	pixelData.resize(_render->size);
+	std::size_t cores = settings.threadCount;
+	if (cores == 0)
+	{
+		cores = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1;
+	}
 
-	haltonSampler = new HaltonSampler;
+	scheduler.Init(width, height, settings.tileSize, (unsigned int)cores);
+	spdlog::info("rendering {} tiles of {}px on {} threads", scheduler.GetTileCount(), settings.tileSize, cores);
 
-	width = _render->width;
-	height = _render->height;
-	size = _render->size;
+	startTime = std::chrono::steady_clock::now();
+	lastCheckpoint = startTime;
 
-	thread = new std::thread(&RenderWorker::Run, this);
+	if (settings.samplesPerPixel > 0 && resumedPassCount >= settings.samplesPerPixel)
+	{
+		spdlog::info("checkpoint already has {} passes", resumedPassCount);
+		return;
+	}
+	// pixels that had converged before the checkpoint stay skipped
+	if (settings.adaptiveThreshold > 0.0f && resumedPassCount >= settings.minSampleCount)
+	{
+		UpdateConvergence();
+	}
+
+	for (std::size_t i = 0; i < cores; i++)
+	{
+		auto worker = new RenderWorker(i, this);
+		workers.push_back(worker);
+	}
 }
 
-void RenderWorker::Run()
+void PathTracer::Join()
 {
-	int index = originalIndex;
+	for (int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->Join();
+	}
+	endTime = std::chrono::steady_clock::now();
+}
 
-	while (true)
+unsigned long long PathTracer::GetSampleCount() const
+{
+	unsigned long long count = 0;
+	for (auto worker : workers)
 	{
-		int y = index / renderImage.GetWidth();
-		int x = index - y * renderImage.GetWidth();
+		count += worker->sampleCount;
+	}
+	return count;
+}
 
-		PixelContext& historyContext = pixelData[x + y * width];
-		historyContext.CurrentSampleNum += 1;
+unsigned int PathTracer::GetPassCount() const
+{
+	return scheduler.GetPassCount() + resumedPassCount;
+}
 
-		float factor = (1.0f / (float)(historyContext.CurrentSampleNum));
+float PathTracer::GetRenderTime() const
+{
+	return std::chrono::duration<float>(endTime - startTime).count();
+}
 
-		RayContext primaryRay = haltonSampler->SamplePixel(x, y, historyContext.offset, historyContext.CurrentSampleNum - 1);
+bool PathTracer::UpdateConvergence()
+{
+	unsigned int activeTiles = 0;
+	for (unsigned int i = 0; i < scheduler.GetTileCount(); i++)
+	{
+		const Tile& tile = scheduler.GetTile(i);
+		bool active = false;
+		for (unsigned int y = tile.y0; y < tile.y1; y++)
+		{
+			for (unsigned int x = tile.x0; x < tile.x1; x++)
+			{
+				unsigned int pixelIndex = x + y * width;
+				if (!converged[pixelIndex])
+				{
+					converged[pixelIndex] = film.GetRelativeError(x, y) < settings.adaptiveThreshold;
+				}
+				active = active || !converged[pixelIndex];
+			}
+		}
+		scheduler.SetTileActive(i, active);
+		activeTiles += active ? 1 : 0;
+	}
+	return activeTiles > 0;
+}
 
-		auto renderResult = RenderPixel(primaryRay, x, y);
+void RenderWorker::Join()
+{
+	thread->join();
+}
 
-		historyContext.color
-			// = sampleResult.color;
-			= ((float)(historyContext.CurrentSampleNum - 1) * historyContext.color + (renderResult.color)) * factor;
+RenderWorker::RenderWorker(int _index, PathTracer* _render)
+{
+	index = _index;
+	render = _render;
+	sampler.reset(CreateSampler(render->settings.sampler, render->settings.seed));
 
-		// historyContext.color.ClampMax();
+	thread = new std::thread(&RenderWorker::Run, this);
+}
 
-		const auto& finalColor = historyContext.color;
+void RenderWorker::Run()
+{
+	film.PrepareSample(sample);
 
-		historyContext.z = historyContext.z + (renderResult.z * factor);
-		historyContext.normal = historyContext.normal + (renderResult.normal * factor);
+	auto stop = [&](unsigned int passCount)
+	{
+		return render->EndPass(passCount + render->resumedPassCount);
+	};
 
-		if (outputing.load())
+	// budgets are checked between passes, so every pixel ends up with the same sample count
+	do
+	{
+		Tile tile;
+		while (!outputing.load() && render->scheduler.NextTile(index, tile))
 		{
-			spdlog::info("Worker Break!");
-			break;
+			RenderTile(tile);
 		}
+	} while (render->scheduler.EndPass(stop));
+}
 
-		RenderImageHelper::SetPixel(renderImage, x, y, Color24(finalColor.r * 255.0f, finalColor.g * 255.0f, finalColor.b * 255.0f));
+void RenderWorker::RenderTile(const Tile& tile)
+{
+	for (unsigned int y = tile.y0; y < tile.y1; y++)
+	{
+		for (unsigned int x = tile.x0; x < tile.x1; x++)
+		{
+			if (render->converged[x + y * render->width])
+			{
+				continue;
+			}
 
-		index += cores;
+			sampler->StartSample(x + y * render->width, film.GetSampleCount(x, y));
 
-		if (index > (size - 1))
-		{
-			index = originalIndex;
+			RayContext primaryRay = SamplePixel(x, y, *sampler);
+
+			RenderPixel(primaryRay, x, y, *sampler, sample);
+
+			film.AddSample(x, y, sample);
+			sampleCount++;
 		}
 	}
-}
\ No newline at end of file
+}
@@ -11,6 +11,8 @@
 #include <thread>
 #include <vector>
 #include <future>
+#include <fstream>
+#include <iterator>
 
 #include "spdlog/spdlog.h"
 #include "GLFW/glfw3.h"
@@ -26,9 +28,16 @@
 #include "config.h"
 
 #include "bvh.h"
+#include "sceneaccel.h"
 
 #include "pathtracer.h"
 #include "constants.h"
+#include "film.h"
+#include "imageio.h"
+#include "denoiser.h"
+#include "lightsampler.h"
+#include "environmentlight.h"
+#include "lightcomponent.h"
 
 Node rootNode;
 Camera camera;
@@ -40,7 +49,12 @@ TexturedColor background;
 TexturedColor environment;
 TextureList textureList;
 BVHManager bvhManager;
+BVHBuildSettings bvhBuildSettings;
+SceneAccel sceneAccel;
 LightComList lightList;
+LightSampler lightSampler;
+EnvironmentLight environmentLight;
+Film film;
 
 std::atomic<bool> outputing;
 
@@ -64,76 +78,21 @@ float buildTime = 0.0f;
 
 IrradianceCacheMap irradianceCacheMap;
 
-bool InternalLightTest(Node* node, HitInfo& hitinfo, Ray& ray, Node* light)
+bool Occluded(Ray const& ray, float tMin, float tMax, Node const* ignoreNode)
 {
-	Ray objectRay = node->ToNodeCoords(ray);
-	Object* obj = node->GetNodeObj();
-
-	if (obj != nullptr && node == light)
-	{
-		HitInfo objHitInfo;
-		if (obj->IntersectRay(objectRay, objHitInfo, HIT_FRONT_AND_BACK))
-		{
-			hitinfo.Copy(objHitInfo);
-			node->FromNodeCoords(hitinfo);
-			return true;
-		}
-	}
-
-	for (int i = 0; i < node->GetNumChild(); i++)
-	{
-		Node* child = node->GetChild(i);
-
-		HitInfo objHitInfo;
-		if (InternalLightTest(child, objHitInfo, objectRay, light))
-		{
-			hitinfo.Copy(objHitInfo);
-			node->FromNodeCoords(hitinfo);
-			return true;
-		}
-	}
-
-	return false;
+	return sceneAccel.Occluded(ray, tMin, tMax, ignoreNode);
 }
 
-bool InternalNonLightTest(Node* node, Ray& ray, float t_max, Node* light, float lightZ)
+bool IntersectNode(Ray const& ray, HitInfo& hitInfo, Node const* node, int side)
 {
-	Ray objectRay = node->ToNodeCoords(ray);
-	Object* obj = node->GetNodeObj();
-
-	bool result = false;
-	// dont test light itself
-	if (obj != nullptr && node != light)
-	{
-		HitInfo objHitInfo;
-		if (obj->IntersectRay(objectRay, objHitInfo, HIT_FRONT))
-		{
-			// closer than light
-			if (objHitInfo.z < t_max && objHitInfo.z < lightZ)
-			{
-				return true;
-			}
-		}
-	}
-
-	for (int i = 0; i < node->GetNumChild(); i++)
-	{
-		Node* child = node->GetChild(i);
-
-		if (InternalNonLightTest(child, objectRay, t_max, light, lightZ))
-		{
-			return true;
-		}
-	}
-
-	return false;
+	return sceneAccel.IntersectNode(ray, hitInfo, node, side);
 }
 
 bool LightVisTest(Ray& ray, HitInfo& hitInfo,float t_max, Node* light)
 {
 	// if hit on light back side, must no light , pdf zero
 	HitInfo lightHitInfo;
-	if (InternalLightTest(&rootNode, lightHitInfo, ray, light))
+	if (IntersectNode(ray, lightHitInfo, light, HIT_FRONT_AND_BACK))
 	{
 		hitInfo.Copy(lightHitInfo);
 		if (!lightHitInfo.front)
@@ -148,42 +107,12 @@ bool LightVisTest(Ray& ray, HitInfo& hitInfo,float t_max, Node* light)
 	}
 
 	// if hit obj closer than light, pdf zero
-	return InternalNonLightTest(&rootNode, ray, t_max, light, lightHitInfo.z);
-}
-
-bool InternalGenerateRayForAnyIntersection(Node* node, Ray& ray, float t_max)
-{
-    Ray objectRay = node->ToNodeCoords(ray);
-    Object* obj = node->GetNodeObj();
-    
-    if(obj != nullptr)
-    {
-        HitInfo objHitInfo;
-        if(obj->IntersectRay(objectRay, objHitInfo))
-        {
-            if(objHitInfo.z < t_max)
-            {
-                return true;
-            }
-        }
-    }
-    
-    for(int i = 0; i < node->GetNumChild(); i++)
-    {
-        Node* child = node->GetChild(i);
-        
-        if(InternalGenerateRayForAnyIntersection(child, objectRay, t_max))
-        {
-            return true;
-        }
-    }
-    
-    return false;
+	return Occluded(ray, 0.0f, Min(t_max, lightHitInfo.z), light);
 }
 
 bool GenerateRayForAnyIntersection(Ray& ray, float t_max)
 {
-    return InternalGenerateRayForAnyIntersection(&rootNode, ray, t_max);
+    return Occluded(ray, 0.0f, t_max);
 }
 
 bool TraceNode(HitInfoContext& hitInfoContext, RayContext& rayContext, Node* node, int side)
@@ -257,9 +186,19 @@ bool TraceNode(HitInfoContext& hitInfoContext, RayContext& rayContext, Node* nod
     return result;
 }
 
+bool TraceScene(HitInfoContext& hitInfoContext, RayContext& rayContext, int side)
+{
+    if(sceneAccel.IsEmpty())
+    {
+        return TraceNode(hitInfoContext, rayContext, &rootNode, side);
+    }
+    
+    return sceneAccel.Trace(hitInfoContext, rayContext, side);
+}
+
 bool GenerateRayForNearestIntersection(RayContext& rayContext, HitInfoContext& hitinfoContext, int side, float& t)
 {
-    bool result = TraceNode(hitinfoContext, rayContext, &rootNode, side);
+    bool result = TraceScene(hitinfoContext, rayContext, side);
     
     if(result)
     {
@@ -269,10 +208,10 @@ bool GenerateRayForNearestIntersection(RayContext& rayContext, HitInfoContext& h
     return result;
 }
 
-Ray GenCameraRay(int x, int y, float xOffset, float yOffset, bool normalize)
+Ray GenCameraRay(int x, int y, float xOffset, float yOffset, Vec2f lensSample, bool normalize)
 {
     // random in a circle
-    Vec2f randomCirclePoint = RandomPointInCircle(camera.dof);
+    Vec2f randomCirclePoint = RandomPointInCircle(camera.dof, lensSample);
     
     Ray cameraRay;
     cameraRay.p = camera.pos + cameraRight * randomCirclePoint.x + cameraUp * randomCirclePoint.y;
@@ -290,11 +229,11 @@ Ray GenCameraRay(int x, int y, float xOffset, float yOffset, bool normalize)
 }
 
 
-RayContext GenCameraRayContext(int x, int y, float offsetX, float offsetY)
+RayContext GenCameraRayContext(int x, int y, float offsetX, float offsetY, Vec2f lensSample)
 {
     float delta = RAY_DIFF_DELTA;
     
-    auto ray = GenCameraRay(x, y, offsetX, offsetY, false);
+    auto ray = GenCameraRay(x, y, offsetX, offsetY, lensSample, false);
     
     RayContext result;
     result.cameraRay = ray;
@@ -332,10 +271,87 @@ void InitCamera()
 	texelHeight = imgPlaneHeight / static_cast<float>(camera.imgHeight);
 }
 
-void RayTracer::Init()
+bool RayTracer::Init()
 {
 	outputing = false;
 #ifdef IMGUI_DEBUG
+    if(!headless)
+    {
+        InitTextures();
+    }
+#endif
+    // scene load, ini global variables
+    buildTime = 0.0f;
+    if(!LoadScene(scene_path.c_str()))
+    {
+        spdlog::error("failed to load scene {}", scene_path);
+        return false;
+    }
+    // sized before any render thread starts, the viewer resolves it concurrently
+    film.Init(renderImage.GetWidth(), renderImage.GetHeight());
+    InitFilmLayers();
+    InitLightSampler();
+    sceneAccel.Build(&rootNode);
+    spdlog::info("scene {} loaded, bvh build time {}s", scene_path, buildTime + sceneAccel.GetBuildTime());
+    spdlog::info("intersection kernels: {}", GetSIMDLevelName(GetSIMDLevel()));
+	InitCamera();
+	return true;
+}
+
+void RayTracer::InitFilmLayers()
+{
+	for (AOVType type : settings.aovs)
+	{
+		if (type != AOVType::Light)
+		{
+			film.AddLayer(type);
+			continue;
+		}
+		for (unsigned int i = 0; i < lightList.size(); i++)
+		{
+			film.AddLayer(AOVType::Light, i);
+		}
+	}
+
+	// the viewer's tabs and the denoiser's guides
+	if (!headless || denoise)
+	{
+		film.AddLayer(AOVType::Albedo);
+		film.AddLayer(AOVType::Normal);
+		film.AddLayer(AOVType::Depth);
+	}
+}
+
+void RayTracer::InitLightSampler()
+{
+	lightSampler.Build(lightList, settings.lightSampler);
+	environmentLight.Build(environment);
+}
+
+uint64_t RayTracer::HashScene() const
+{
+	uint64_t hash = FNVOffsetBasis;
+	HashBytes(hash, scene_path.data(), scene_path.size());
+
+	// an edited scene file is a different scene, even under the same name
+	std::ifstream file(scene_path, std::ios::binary);
+	std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	HashBytes(hash, contents.data(), contents.size());
+
+	// the sample count is left out, resuming with a higher one is how a render is continued
+	HashValue(hash, camera.pos);
+	HashValue(hash, camera.dir);
+	HashValue(hash, camera.up);
+	HashValue(hash, camera.fov);
+	HashValue(hash, camera.focaldist);
+	HashValue(hash, camera.dof);
+	HashValue(hash, camera.imgWidth);
+	HashValue(hash, camera.imgHeight);
+	return hash;
+}
+
+void RayTracer::InitTextures()
+{
     if(!renderTexture)
     {
         renderTexture = std::make_shared<Texture2D>();
@@ -360,11 +376,6 @@ void RayTracer::Init()
 	{
 		irradianceTexture = std::make_shared<Texture2D>();
 	}
-    
-#endif
-    // scene load, ini global variables
-    LoadScene(scene_path);
-	InitCamera();
 }
 
 void ComputeIrradianceCacheMap()
@@ -411,11 +422,6 @@ void RayTracer::Run()
 
 	mySampleImg = new Color24[renderImage.GetWidth() * renderImage.GetHeight()];
     
-    float now = glfwGetTime();
-    
-    std::size_t cores = std::thread::hardware_concurrency() - 1;
-    std::vector<std::future<void>> threads;
-    
     std::size_t size = renderImage.GetWidth() * renderImage.GetHeight();
     
     renderImage.ResetNumRenderedPixels();
@@ -433,16 +439,62 @@ void RayTracer::Run()
 		irradianceThread4.join();
 	}
 
+	settings.sceneHash = HashScene();
 	PathTracer pathTracer;
-	pathTracer.Init(renderImage.GetWidth(), renderImage.GetHeight());
+	pathTracer.Init(renderImage.GetWidth(), renderImage.GetHeight(), settings);
 	pathTracer.Run();
 	pathTracer.Join();
+
+	renderedSamples = pathTracer.GetSampleCount();
+	renderedPasses = pathTracer.GetPassCount();
+	renderTime = pathTracer.GetRenderTime();
+}
+
+int RayTracer::RunHeadless()
+{
+	headless = true;
+	if (settings.samplesPerPixel == 0 && settings.timeBudget <= 0.0f)
+	{
+		settings.samplesPerPixel = MaxPixelSampleCount;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (!Init())
+	{
+		return 1;
+	}
+	float loadTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+	Run();
+
+	if (denoise)
+	{
+		auto denoiseStart = std::chrono::steady_clock::now();
+		ATrousDenoiser denoiser;
+		denoiser.threadCount = settings.threadCount;
+		denoiser.Denoise(film, denoised);
+		spdlog::info("denoised in {}s", std::chrono::duration<float>(std::chrono::steady_clock::now() - denoiseStart).count());
+	}
+
+	if (!WriteToFile())
+	{
+		spdlog::error("failed to write {}", outputPath);
+		return 1;
+	}
+
+	float totalTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	spdlog::info("{}x{} rendered with {} spp in {}s, {:.2f} Msamples/s", renderImage.GetWidth(), renderImage.GetHeight(), renderedPasses, renderTime,
+		renderTime > 0.0f ? renderedSamples / renderTime * 1e-6f : 0.0f);
+	spdlog::info("scene load {}s, total {}s, written to {}", loadTime, totalTime, outputPath);
+	return 0;
 }
 
 void RayTracer::UpdateRenderResult()
 {
-    RenderImageHelper::CalculateMyDepthImg(myZImg, renderImage);
-    RenderImageHelper::CalculateMySampleImg(mySampleImg, renderImage);
+    film.Resolve(renderImage);
+    film.ResolveLayer(AOVType::Depth, myZImg);
+    film.ResolveLayer(AOVType::SampleCount, mySampleImg);
+    film.ResolveLayer(AOVType::Normal, normalPixels);
     
     sampleTexture->SetData((unsigned char *)mySampleImg, renderImage.GetWidth(), renderImage.GetHeight(), GL_RGB);
     zbufferTexture->SetData((unsigned char *)myZImg, renderImage.GetWidth(), renderImage.GetHeight(), GL_RGB);
@@ -452,13 +504,30 @@ void RayTracer::UpdateRenderResult()
 //    filterTexture->SetData((unsigned char *)colorShiftFilter->GetOutput(), renderImage.GetWidth(), renderImage.GetHeight());
 }
 
+void RayTracer::UpdateDenoisedResult()
+{
+	ATrousDenoiser denoiser;
+	std::vector<Color> colors;
+	if (!denoiser.Denoise(film, colors))
+	{
+		return;
+	}
+
+	std::vector<Color24> pixels(colors.size());
+	for (size_t i = 0; i < colors.size(); i++)
+	{
+		pixels[i] = Film::ToDisplay(colors[i]);
+	}
+	filterTexture->SetData((unsigned char*)pixels.data(), film.GetWidth(), film.GetHeight());
+}
+
 void RayTracer::Pause()
 {
 	outputing = true;
 	spdlog::info("Outputing Set To True");
 }
 
-void RayTracer::WriteToFile()
+bool RayTracer::WriteToFile()
 {
 	
 	
@@ -467,8 +536,49 @@ void RayTracer::WriteToFile()
 	// renderImage.SaveImage("color.png", tempData);
 
 	// outputing = false;
-     renderImage.SaveImage("colorbuffer.png");
     // renderImage.SaveZImage("zbuffer.png");
     // renderImage.SaveSampleCountImage("samplecount.png");
-	
+	// HDR formats get the linear radiance, straight from the film
+	std::string format = ImageIO::GetFormat(outputPath);
+	unsigned int width = film.GetWidth();
+	bool useDenoised = denoise && denoised.size() == (size_t)width * film.GetHeight();
+
+	// the denoised beauty replaces the film's, the layers stay as rendered
+	auto replaceBeauty = [&](unsigned int y, float* values, unsigned int channelCount)
+	{
+		for (unsigned int x = 0; useDenoised && x < width; x++)
+		{
+			const Color& color = denoised[x + y * width];
+			values[x * channelCount + 0] = color.r;
+			values[x * channelCount + 1] = color.g;
+			values[x * channelCount + 2] = color.b;
+		}
+	};
+
+	auto scanline = [&](unsigned int y, float* rgb) { film.GetScanline(y, rgb); replaceBeauty(y, rgb, 3); };
+	if (format == "pfm")
+	{
+		return ImageIO::WritePFM(outputPath, width, film.GetHeight(), scanline);
+	}
+	if (format == "exr")
+	{
+		// every registered layer goes into the same file, as float so depth and positions keep their precision
+		std::vector<std::string> names = film.GetChannelNames();
+		unsigned int channelCount = (unsigned int)names.size();
+		auto channels = [&](unsigned int y, float* values) { film.GetChannels(y, values); replaceBeauty(y, values, channelCount); };
+		bool hasLayers = !film.GetLayers().empty();
+		return ImageIO::WriteEXR(outputPath, width, film.GetHeight(), names,
+			hasLayers ? ImageIO::PixelType::Float : ImageIO::PixelType::Half, hasLayers ? ImageIO::ScanlineFunc(channels) : ImageIO::ScanlineFunc(scanline));
+	}
+
+	film.Resolve(renderImage);
+	if (useDenoised)
+	{
+		Color24* pixels = renderImage.GetPixels();
+		for (size_t i = 0; i < denoised.size(); i++)
+		{
+			pixels[i] = Film::ToDisplay(denoised[i]);
+		}
+	}
+	return renderImage.SaveImage(outputPath.c_str());
 }
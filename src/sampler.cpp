@@ -1,33 +1,25 @@
 #include "sampler.h"
+#include "sobol.h"
 #include "raytracer.h"
 #include "renderimagehelper.h"
 #include "spdlog/spdlog.h"
 
 extern RenderImage renderImage;
 
-HaltonSampler::HaltonSampler()
+SamplerContext* CreateSampler(SamplerType type, uint64_t seed)
 {
-    int64_t seed = 6000;
-    std::seed_seq ss{uint32_t(seed & 0xffffffff), uint32_t(seed>>32)};
-    rng.seed(ss);
-}
-
-RayContext HaltonSampler::SamplePixel(int x, int y, Vec2f& randomOffset, int index) const
-{
-    Vec2f samplerPos = Vec2f(Halton(index, haltonXBase) - 0.5f, Halton(index, haltonYBase) - 0.5f);
-      
-    float finalX = samplerPos.x + randomOffset.x;
-    if(finalX >= 0.5f)
+    switch (type)
     {
-        finalX -= 1.0f;
+    case SamplerType::Random:
+        return new RandomSampler(seed);
+    case SamplerType::Sobol:
+    default:
+        return new SobolSampler(seed);
     }
-        
-    float finalY = samplerPos.y + randomOffset.y;
-    if(finalY >= 0.5f)
-    {
-        finalY -= 1.0f;
-    }
-        
-    return GenCameraRayContext(x, y, finalX, finalY);
 }
 
+RayContext SamplePixel(int x, int y, SamplerContext& sampler)
+{
+    Vec2f pixel = sampler.GetPixel2D();
+    return GenCameraRayContext(x, y, pixel.x - 0.5f, pixel.y - 0.5f, sampler.Next2D());
+}
@@ -0,0 +1,219 @@
+#include "sceneaccel.h"
+#include "spdlog/spdlog.h"
+
+void SceneAccel::Clear()
+{
+	instances.clear();
+	unbounded.clear();
+	nodeInstances.clear();
+	instanceBounds.clear();
+	bvh.nodes.clear();
+	bvh.primitives.clear();
+	buildSeconds = 0.0f;
+}
+
+void SceneAccel::CollectInstances(Node* node, Matrix3f const& parentTm, Vec3f const& parentPos)
+{
+	// world = parent(tm * p + pos)
+	Matrix3f worldTm = parentTm * node->GetTransform();
+	Vec3f worldPos = parentTm * node->GetPosition() + parentPos;
+
+	Object* obj = node->GetNodeObj();
+	if (obj != nullptr)
+	{
+		SceneInstance instance;
+		instance.node = node;
+		instance.obj = obj;
+		instance.mtl = node->GetMaterial();
+		instance.InitTransform();
+		instance.Transform(worldTm);
+		instance.Translate(worldPos);
+
+		Box box = obj->GetBoundBox();
+		BVHBound bound;
+		bool finite = !box.IsEmpty();
+		for (int i = 0; i < 8 && finite; i++)
+		{
+			Vec3f corner = instance.TransformFrom(box.Corner(i));
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (!(fabsf(corner[axis]) < BIGFLOAT))
+				{
+					finite = false;
+				}
+			}
+			bound.UpdateByPoint(corner);
+		}
+
+		unsigned int index = (unsigned int)instances.size();
+		instances.push_back(instance);
+		nodeInstances[node] = index;
+
+		if (finite)
+		{
+			// planes have flat boxes, pad them so the slab test and the SAH areas stay well defined
+			Vec3f extent = bound.GetMax() - bound.GetMin();
+			float pad = Max(extent.Max() * 1e-4f, 1e-5f);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				bound.data[axis] -= pad;
+				bound.data[axis + 3] += pad;
+			}
+
+			instanceIds.push_back(index);
+			instanceBounds.push_back(bound);
+		}
+		else
+		{
+			unbounded.push_back(index);
+		}
+	}
+
+	for (int i = 0; i < node->GetNumChild(); i++)
+	{
+		CollectInstances(node->GetChild(i), worldTm, worldPos);
+	}
+}
+
+void SceneAccel::Build(Node* root)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Clear();
+
+	Matrix3f identity;
+	identity.SetIdentity();
+	CollectInstances(root, identity, Vec3f(0.0f, 0.0f, 0.0f));
+
+	if (!instanceBounds.empty())
+	{
+		// an instance test costs a whole bottom level traversal, so always split down to single instances
+		BVHBuildSettings settings = bvhBuildSettings;
+		settings.method = BVHBuildMethod::BinnedSAH;
+		settings.maxLeafSize = 1;
+
+		BinnedSAHBuilder builder(settings);
+		BVHNode* tree = builder.Build(instanceBounds);
+		bvh.Flatten(tree);
+		DeleteBVHTree(tree);
+
+		// leaves hold indices into instanceBounds, map them back to instances
+		for (auto& primitive : bvh.primitives)
+		{
+			primitive = instanceIds[primitive];
+		}
+	}
+
+	instanceIds.clear();
+	instanceBounds.clear();
+
+	buildSeconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+	spdlog::info("scene accel built over {} instances ({} unbounded) in {}s", instances.size(), unbounded.size(), buildSeconds);
+}
+
+bool SceneAccel::Trace(HitInfoContext& hitInfoContext, RayContext& rayContext, int side) const
+{
+	HitInfo& hitInfo = hitInfoContext.mainHitInfo;
+	HitInfo& rightInfo = hitInfoContext.rightHitInfo;
+	HitInfo& topInfo = hitInfoContext.topHitInfo;
+
+	float tMax = hitInfo.z;
+
+	// ray parameters survive the affine transformation since the local direction is not renormalized,
+	// so distances from different instances compare directly
+	auto traceInstance = [&](unsigned int instanceId, float& t)
+	{
+		const SceneInstance& instance = instances[instanceId];
+		RayContext rayContextInInstanceSpace = instance.ToLocal(rayContext);
+
+		HitInfoContext currentHitInfoContext;
+		HitInfo& currentHitInfo = currentHitInfoContext.mainHitInfo;
+		currentHitInfo.z = t;
+
+		if (instance.obj->IntersectRay(rayContextInInstanceSpace, currentHitInfoContext, side) && currentHitInfo.z < t)
+		{
+			t = currentHitInfo.z;
+
+			hitInfo.Copy(currentHitInfo);
+			hitInfo.node = instance.node;
+			hitInfo.mtl = instance.mtl;
+
+			rightInfo.CopyForDiffRay(currentHitInfoContext.rightHitInfo);
+			topInfo.CopyForDiffRay(currentHitInfoContext.topHitInfo);
+
+			instance.FromLocal(hitInfoContext);
+			return true;
+		}
+		return false;
+	};
+
+	bool hit = false;
+	for (unsigned int instanceId : unbounded)
+	{
+		if (traceInstance(instanceId, tMax))
+		{
+			hit = true;
+		}
+	}
+
+	auto traceSlot = [&](unsigned int slot, float& t)
+	{
+		return traceInstance(bvh.primitives[slot], t);
+	};
+
+	if (bvh.Traverse(rayContext.cameraRay, tMax, traceSlot))
+	{
+		hit = true;
+	}
+
+	return hit;
+}
+
+bool SceneAccel::Occluded(Ray const& ray, float tMin, float tMax, Node const* ignoreNode, int side) const
+{
+	auto occludedByInstance = [&](unsigned int instanceId)
+	{
+		const SceneInstance& instance = instances[instanceId];
+		if (instance.node == ignoreNode)
+		{
+			return false;
+		}
+		return instance.obj->Occluded(instance.ToLocal(ray), tMin, tMax, side);
+	};
+
+	for (unsigned int instanceId : unbounded)
+	{
+		if (occludedByInstance(instanceId))
+		{
+			return true;
+		}
+	}
+
+	return bvh.TraverseAny(ray, tMax, [&](unsigned int slot)
+	{
+		return occludedByInstance(bvh.primitives[slot]);
+	});
+}
+
+bool SceneAccel::IntersectNode(Ray const& ray, HitInfo& hitInfo, Node const* node, int side) const
+{
+	auto it = nodeInstances.find(node);
+	if (it == nodeInstances.end())
+	{
+		return false;
+	}
+
+	const SceneInstance& instance = instances[it->second];
+
+	HitInfo currentHitInfo;
+	if (instance.obj->IntersectRay(instance.ToLocal(ray), currentHitInfo, side) && currentHitInfo.z < hitInfo.z)
+	{
+		hitInfo.Copy(currentHitInfo);
+		hitInfo.node = instance.node;
+		hitInfo.mtl = instance.mtl;
+		instance.FromLocal(hitInfo);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,374 @@
+#include "simd.h"
+#include "triangle.h"
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits AVX for intrinsics anywhere, gcc and clang need the function marked for it
+#if SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+static SIMDLevel DetectSIMDLevel()
+{
+#if SIMD_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7)
+	{
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+
+		// the os has to save the ymm registers too
+		if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+		{
+			return SIMDLevel::AVX2;
+		}
+	}
+	return SIMDLevel::SSE;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SIMDLevel::AVX2;
+	}
+	return SIMDLevel::SSE;
+#endif
+#else
+	return SIMDLevel::Scalar;
+#endif
+}
+
+SIMDLevel GetSIMDLevel()
+{
+	static const SIMDLevel level = []()
+	{
+		SIMDLevel detected = DetectSIMDLevel();
+
+		const char* requested = getenv("RAYTRACER_SIMD");
+		if (requested != nullptr)
+		{
+			SIMDLevel cap = detected;
+			if (strcmp(requested, "scalar") == 0)
+			{
+				cap = SIMDLevel::Scalar;
+			}
+			else if (strcmp(requested, "sse") == 0)
+			{
+				cap = SIMDLevel::SSE;
+			}
+			if ((int)cap < (int)detected)
+			{
+				detected = cap;
+			}
+		}
+		return detected;
+	}();
+
+	return level;
+}
+
+const char* GetSIMDLevelName(SIMDLevel level)
+{
+	switch (level)
+	{
+	case SIMDLevel::AVX2:
+		return "avx2";
+	case SIMDLevel::SSE:
+		return "sse";
+	default:
+		return "scalar";
+	}
+}
+
+// keeps the closest of the lanes in mask, lanes are numbered from laneBase
+static bool ReduceLanes(int mask, int laneBase, const float* t, const float* u, const float* v, int frontMask, PacketHit& hit)
+{
+	bool found = false;
+	for (int lane = 0; mask != 0; lane++, mask >>= 1)
+	{
+		if ((mask & 1) && t[lane] < hit.t)
+		{
+			hit.lane = laneBase + lane;
+			hit.t = t[lane];
+			hit.u = u[lane];
+			hit.v = v[lane];
+			hit.front = ((frontMask >> lane) & 1) != 0;
+			found = true;
+		}
+	}
+	return found;
+}
+
+static int IntersectPacketScalar(const TrianglePacket4& packet, SIMDRay const& ray, int hitSide, float tMin, float tMax, float* t, float* u, float* v, int& frontMask)
+{
+	Ray scalarRay(Vec3f(ray.origin[0], ray.origin[1], ray.origin[2]), Vec3f(ray.dir[0], ray.dir[1], ray.dir[2]));
+
+	int mask = 0;
+	frontMask = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		PrecomputedTriangle triangle;
+		triangle.v0 = Vec3f(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+		triangle.e1 = Vec3f(packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]);
+		triangle.e2 = Vec3f(packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]);
+
+		bool front;
+		if (triangle.Intersect(scalarRay, hitSide, tMax, t[lane], u[lane], v[lane], front) && t[lane] >= tMin)
+		{
+			mask |= 1 << lane;
+			frontMask |= (front ? 1 : 0) << lane;
+		}
+	}
+	return mask;
+}
+
+#if SIMD_X86
+
+static int IntersectPacketSSE(const TrianglePacket4& packet, SIMDRay const& ray, int hitSide, float tMin, float tMax, float* tOut, float* uOut, float* vOut, int& frontMask)
+{
+	__m128 dx = _mm_set1_ps(ray.dir[0]);
+	__m128 dy = _mm_set1_ps(ray.dir[1]);
+	__m128 dz = _mm_set1_ps(ray.dir[2]);
+
+	__m128 e1x = _mm_load_ps(packet.e1[0]);
+	__m128 e1y = _mm_load_ps(packet.e1[1]);
+	__m128 e1z = _mm_load_ps(packet.e1[2]);
+	__m128 e2x = _mm_load_ps(packet.e2[0]);
+	__m128 e2y = _mm_load_ps(packet.e2[1]);
+	__m128 e2z = _mm_load_ps(packet.e2[2]);
+
+	// pvec = dir x e2
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 valid = _mm_cmpgt_ps(absDet, _mm_set1_ps(FLT_EPSILON));
+	__m128 front = _mm_cmpgt_ps(det, zero);
+	if (!(hitSide & HIT_FRONT))
+	{
+		valid = _mm_andnot_ps(front, valid);
+	}
+	if (!(hitSide & HIT_BACK))
+	{
+		valid = _mm_and_ps(front, valid);
+	}
+
+	__m128 invDet = _mm_div_ps(one, det);
+
+	__m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_load_ps(packet.v0[0]));
+	__m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_load_ps(packet.v0[1]));
+	__m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_load_ps(packet.v0[2]));
+
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+	// qvec = tvec x e1
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tMin)), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+
+	int mask = _mm_movemask_ps(valid);
+	if (mask != 0)
+	{
+		_mm_storeu_ps(tOut, t);
+		_mm_storeu_ps(uOut, u);
+		_mm_storeu_ps(vOut, v);
+		frontMask = _mm_movemask_ps(front);
+	}
+	return mask;
+}
+
+SIMD_TARGET_AVX2
+static inline __m256 LoadPacketPair(const float* low, const float* high)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(low)), _mm_load_ps(high), 1);
+}
+
+// same as the SSE kernel, two packets side by side
+SIMD_TARGET_AVX2
+static int IntersectPacketPairAVX2(const TrianglePacket4* packets, SIMDRay const& ray, int hitSide, float tMin, float tMax, float* tOut, float* uOut, float* vOut, int& frontMask)
+{
+	const TrianglePacket4& low = packets[0];
+	const TrianglePacket4& high = packets[1];
+
+	__m256 dx = _mm256_set1_ps(ray.dir[0]);
+	__m256 dy = _mm256_set1_ps(ray.dir[1]);
+	__m256 dz = _mm256_set1_ps(ray.dir[2]);
+
+	__m256 e1x = LoadPacketPair(low.e1[0], high.e1[0]);
+	__m256 e1y = LoadPacketPair(low.e1[1], high.e1[1]);
+	__m256 e1z = LoadPacketPair(low.e1[2], high.e1[2]);
+	__m256 e2x = LoadPacketPair(low.e2[0], high.e2[0]);
+	__m256 e2y = LoadPacketPair(low.e2[1], high.e2[1]);
+	__m256 e2z = LoadPacketPair(low.e2[2], high.e2[2]);
+
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+	__m256 valid = _mm256_cmp_ps(absDet, _mm256_set1_ps(FLT_EPSILON), _CMP_GT_OQ);
+	__m256 front = _mm256_cmp_ps(det, zero, _CMP_GT_OQ);
+	if (!(hitSide & HIT_FRONT))
+	{
+		valid = _mm256_andnot_ps(front, valid);
+	}
+	if (!(hitSide & HIT_BACK))
+	{
+		valid = _mm256_and_ps(front, valid);
+	}
+
+	__m256 invDet = _mm256_div_ps(one, det);
+
+	__m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), LoadPacketPair(low.v0[0], high.v0[0]));
+	__m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), LoadPacketPair(low.v0[1], high.v0[1]));
+	__m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), LoadPacketPair(low.v0[2], high.v0[2]));
+
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+	__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+
+	int mask = _mm256_movemask_ps(valid);
+	if (mask != 0)
+	{
+		_mm256_storeu_ps(tOut, t);
+		_mm256_storeu_ps(uOut, u);
+		_mm256_storeu_ps(vOut, v);
+		frontMask = _mm256_movemask_ps(front);
+	}
+	return mask;
+}
+
+#endif
+
+bool IntersectTrianglePackets(const TrianglePacket4* packets, unsigned int packetCount, SIMDRay const& ray, int hitSide, float tMin, float tMax, PacketHit& hit)
+{
+	static const SIMDLevel level = GetSIMDLevel();
+
+	float t[8], u[8], v[8];
+	int frontMask = 0;
+	bool found = false;
+	unsigned int i = 0;
+
+#if SIMD_X86
+	if (level == SIMDLevel::AVX2)
+	{
+		for (; i + 1 < packetCount; i += 2)
+		{
+			int mask = IntersectPacketPairAVX2(packets + i, ray, hitSide, tMin, tMax, t, u, v, frontMask);
+			if (mask != 0 && ReduceLanes(mask, i * 4, t, u, v, frontMask, hit))
+			{
+				tMax = hit.t;
+				found = true;
+			}
+		}
+	}
+
+	if (level != SIMDLevel::Scalar)
+	{
+		for (; i < packetCount; i++)
+		{
+			int mask = IntersectPacketSSE(packets[i], ray, hitSide, tMin, tMax, t, u, v, frontMask);
+			if (mask != 0 && ReduceLanes(mask, i * 4, t, u, v, frontMask, hit))
+			{
+				tMax = hit.t;
+				found = true;
+			}
+		}
+	}
+#endif
+
+	for (; i < packetCount; i++)
+	{
+		int mask = IntersectPacketScalar(packets[i], ray, hitSide, tMin, tMax, t, u, v, frontMask);
+		if (mask != 0 && ReduceLanes(mask, i * 4, t, u, v, frontMask, hit))
+		{
+			tMax = hit.t;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+bool OccludedTrianglePackets(const TrianglePacket4* packets, unsigned int packetCount, SIMDRay const& ray, int hitSide, float tMin, float tMax)
+{
+	static const SIMDLevel level = GetSIMDLevel();
+
+	float t[8], u[8], v[8];
+	int frontMask = 0;
+	unsigned int i = 0;
+
+#if SIMD_X86
+	if (level == SIMDLevel::AVX2)
+	{
+		for (; i + 1 < packetCount; i += 2)
+		{
+			if (IntersectPacketPairAVX2(packets + i, ray, hitSide, tMin, tMax, t, u, v, frontMask) != 0)
+			{
+				return true;
+			}
+		}
+	}
+
+	if (level != SIMDLevel::Scalar)
+	{
+		for (; i < packetCount; i++)
+		{
+			if (IntersectPacketSSE(packets[i], ray, hitSide, tMin, tMax, t, u, v, frontMask) != 0)
+			{
+				return true;
+			}
+		}
+	}
+#endif
+
+	for (; i < packetCount; i++)
+	{
+		if (IntersectPacketScalar(packets[i], ray, hitSide, tMin, tMax, t, u, v, frontMask) != 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
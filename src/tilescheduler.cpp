@@ -0,0 +1,125 @@
+#include "tilescheduler.h"
+#include <algorithm>
+
+namespace
+{
+	// spreads the low 16 bits of v over the even bits
+	unsigned int SpreadBits(unsigned int v)
+	{
+		v &= 0x0000ffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	}
+
+	unsigned int MortonCode(unsigned int x, unsigned int y)
+	{
+		return SpreadBits(x) | (SpreadBits(y) << 1);
+	}
+}
+
+void TileScheduler::Init(unsigned int width, unsigned int height, unsigned int tileSize, unsigned int _workerCount)
+{
+	tileSize = tileSize == 0 ? 1 : tileSize;
+	workerCount = _workerCount == 0 ? 1 : _workerCount;
+
+	unsigned int tilesX = (width + tileSize - 1) / tileSize;
+	unsigned int tilesY = (height + tileSize - 1) / tileSize;
+
+	std::vector<unsigned int> codes;
+	tiles.clear();
+	for (unsigned int ty = 0; ty < tilesY; ty++)
+	{
+		for (unsigned int tx = 0; tx < tilesX; tx++)
+		{
+			Tile tile;
+			tile.x0 = tx * tileSize;
+			tile.y0 = ty * tileSize;
+			tile.x1 = std::min(tile.x0 + tileSize, width);
+			tile.y1 = std::min(tile.y0 + tileSize, height);
+			tiles.push_back(tile);
+			codes.push_back(MortonCode(tx, ty));
+		}
+	}
+
+	std::vector<unsigned int> order(tiles.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return codes[a] < codes[b]; });
+
+	std::vector<Tile> sorted(tiles.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		sorted[i] = tiles[order[i]];
+	}
+	tiles.swap(sorted);
+	tileActive.assign(tiles.size(), true);
+
+	queues.reset(new WorkerQueue[workerCount]);
+	arrivedCount = 0;
+	passGeneration = 0;
+	passCount = 0;
+	stopped = false;
+
+	DealPass();
+}
+
+void TileScheduler::DealPass()
+{
+	std::vector<unsigned int> active;
+	active.reserve(tiles.size());
+	for (unsigned int i = 0; i < tiles.size(); i++)
+	{
+		if (tileActive[i])
+		{
+			active.push_back(i);
+		}
+	}
+
+	unsigned int tileCount = (unsigned int)active.size();
+	for (unsigned int worker = 0; worker < workerCount; worker++)
+	{
+		unsigned int begin = (unsigned int)((unsigned long long)tileCount * worker / workerCount);
+		unsigned int end = (unsigned int)((unsigned long long)tileCount * (worker + 1) / workerCount);
+
+		std::lock_guard<std::mutex> lock(queues[worker].mtx);
+		queues[worker].tiles.clear();
+		for (unsigned int i = begin; i < end; i++)
+		{
+			queues[worker].tiles.push_back(active[i]);
+		}
+	}
+}
+
+bool TileScheduler::NextTile(unsigned int worker, Tile& tile)
+{
+	{
+		WorkerQueue& own = queues[worker];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		if (!own.tiles.empty())
+		{
+			tile = tiles[own.tiles.front()];
+			own.tiles.pop_front();
+			return true;
+		}
+	}
+
+	// steal from the back, the tiles furthest away from where the victim is working
+	for (unsigned int i = 1; i < workerCount; i++)
+	{
+		WorkerQueue& victim = queues[(worker + i) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.mtx);
+		if (!victim.tiles.empty())
+		{
+			tile = tiles[victim.tiles.back()];
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
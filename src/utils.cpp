@@ -6,9 +6,19 @@
 #include "utils.h"
 #include "constants.h"
 #include "string_utils.h"
+#include "rng.h"
+#include <atomic>
 
 using namespace cy;
 
+float RandomFloat()
+{
+	// every thread gets its own stream
+	static std::atomic<uint64_t> nextStream(0);
+	thread_local PCG32 rng(MixBits(6000), nextStream++);
+	return rng.NextFloat();
+}
+
 void BranchlessONB(const Vec3f& n, Vec3f& b1, Vec3f& b2)
 {
 	float sign = copysignf(1.0f, n.z);
@@ -21,16 +31,16 @@ void BranchlessONB(const Vec3f& n, Vec3f& b1, Vec3f& b2)
 void CommonOrthonormalBasis(const Vec3f& n, Vec3f& b1, Vec3f& b2)
 {
 	Vec3f randomVector = Vec3f(
-		(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-		(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-		(static_cast <float> (rand()) / static_cast <float> (RAND_MAX))).GetNormalized();
+		RandomFloat(),
+		RandomFloat(),
+		RandomFloat()).GetNormalized();
 
 	while (randomVector.Dot(n) >= (1.0f - RANDOM_THRESHOLD))
 	{
 		randomVector = Vec3f(
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX))).GetNormalized();
+			RandomFloat(),
+			RandomFloat(),
+			RandomFloat()).GetNormalized();
 	}
 
 	b1 = randomVector.Cross(n).GetNormalized();
@@ -44,9 +54,9 @@ Vec3f RandomInUnitSphere()
 	do
 	{
 		result = 2.0f * Vec3f(
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)),
-			(static_cast <float> (rand()) / static_cast <float> (RAND_MAX)))
+			RandomFloat(),
+			RandomFloat(),
+			RandomFloat())
 			- Vec3f(1.0f, 1.0f, 1.0f);
 	} while (result.LengthSquared() >= 1.0f);
 
@@ -55,8 +65,8 @@ Vec3f RandomInUnitSphere()
 
 Vec2f NonUniformRandomPointInCircle(float radius)
 {
-	float r = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* radius;
-	float theta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* TWO_PI;
+	float r = RandomFloat()* radius;
+	float theta = RandomFloat()* TWO_PI;
 
 	float x = r * cos(theta);
 	float y = r * sin(theta);
@@ -65,12 +75,17 @@ Vec2f NonUniformRandomPointInCircle(float radius)
 }
 
 Vec2f RandomPointInCircle(float radius)
+{
+	return RandomPointInCircle(radius, Vec2f(RandomFloat(), RandomFloat()));
+}
+
+Vec2f RandomPointInCircle(float radius, Vec2f u)
 {
 	// generate a random value between 0 to Radius as the value of Cumulative Distribution Function
-	float S = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+	float S = u.x;
 	// S = r2 / R2, choose r based on F
 	float r = sqrtf(S) * radius;
-	float theta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* TWO_PI;
+	float theta = u.y * TWO_PI;
 
 	float x = r * cos(theta);
 	float y = r * sin(theta);
@@ -80,14 +95,14 @@ Vec2f RandomPointInCircle(float radius)
 
 Vec3f UniformRandomPointOnHemiSphere()
 {
-	float cosTheta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+	float cosTheta = RandomFloat();
 	float sinTheta = std::sqrt(1.0f - (cosTheta * cosTheta));
 	if (sinTheta < 0.0f)
 	{
 		sinTheta = 0.0f;
 	}
 
-	float beta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * TWO_PI;
+	float beta = RandomFloat() * TWO_PI;
 
 	// z = 1 * cosTheta, r = 1 * sinTheta, x = cosBeta * sinTheta, y = sinBeta * sinTheta
 	return Vec3f(sinTheta * cos(beta), sinTheta * sin(beta), cosTheta);
@@ -95,23 +110,23 @@ Vec3f UniformRandomPointOnHemiSphere()
 
 Vec3f CosineWeightedRandomPointOnHemiSphere()
 {
-    float F = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+    float F = RandomFloat();
     float cosine2Theta = 1.0f  - 2.0f * F;
     float theta = 0.5f * acos(cosine2Theta);
     float cosTheta = cos(theta);
     float sinTheta = sin(theta);
     
-    float beta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * TWO_PI;
+    float beta = RandomFloat() * TWO_PI;
     
     // z = 1 * cosTheta, r = 1 * sinTheta, x = cosBeta * sinTheta, y = sinBeta * sinTheta
     return Vec3f(sinTheta * cos(beta), sinTheta * sin(beta), cosTheta);
 }
 
-Vec3f ImportanceSampleGGX(float roughness, float& probability)
+Vec3f ImportanceSampleGGX(float roughness, float& probability, Vec2f u)
 {
 	float a = roughness * roughness;
 
-	float F = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * 0.99999f;
+	float F = u.x * 0.99999f;
 	float theta = acos(
 		sqrt(
 		(1.0f - F)/(F * (a*a - 1.0f) + 1.0f)
@@ -126,7 +141,7 @@ Vec3f ImportanceSampleGGX(float roughness, float& probability)
 		cosTheta = 0.0f;
 	}
 
-	float beta = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* TWO_PI;
+	float beta = u.y * TWO_PI;
 
 	float bottom = (a * a - 1.0f) * cosTheta * cosTheta + 1.0f;
 	bottom = bottom * bottom;
@@ -153,7 +168,7 @@ Vec3f ImportanceSampleGGX(float roughness, float& probability)
 int MIS2(float p1, float p2)
 {
 	float total = p1 + p2;
-	float random = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* total;
+	float random = RandomFloat()* total;
 	if (random <= p1)
 	{
 		return 0;
@@ -167,7 +182,7 @@ int MIS2(float p1, float p2)
 int MIS3(float p1, float p2, float p3)
 {
 	float total = p1 + p2 + p3;
-	float random = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* total;
+	float random = RandomFloat()* total;
 
 	if (random <= p1)
 	{
@@ -198,57 +213,19 @@ float LightFallOffFactor(float distance)
 	// return 1.0f / (1.0f + 0.12f * distance + 0.032f * distanceSquare);
 }
 
-Vec2f UniformSampleTriangle()
+Vec2f UniformSampleTriangle(Vec2f u)
 {
-	float u0 = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
-	float u1 = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX));
+	float u0 = u.x;
+	float u1 = u.y;
 	float su0 = std::sqrt(u0);
 	return Vec2f(1.0f - su0, u1 * su0);
 }
 
-int RandomIndexElementInList(int size)
-{
-	// 0 to size
-	return rand() % size;
-}
-
-CDF::CDF()
-	:total(0.0f)
-{
-	Init();
-}
-
-void CDF::Init()
-{
-	cd = std::vector<float>({0.0f});
-	total = (+0.0f);
-}
-
-// rand from 0 to tatal, return the correspond id
-int CDF::Sample() const
-{
-	if (cd.size() == 1)
-	{
-		return 0;
-	}
-
-	float random = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* total;
-	for (int i = 1; i < cd.size(); i++)
-	{
-		if (random <= cd[i] && random >= cd[i - (size_t)1])
-		{
-			return i - 1;
-		}
-	}
-
-	assert(false);
-	return 0;
-}
-
-void CDF::Add(float val)
+int RandomIndexElementInList(int size, float u)
 {
-	total += val;
-	cd.push_back(total);
+	// 0 to size - 1, u is below 1 but the product may still round up
+	int index = (int)(u * size);
+	return index < size ? index : size - 1;
 }
 
 Vec3f ParseVec3f(std::string& str)
@@ -288,11 +265,21 @@ Vec3f ParseVec3f(std::string& str)
 	return Vec3f(r, g, b);
 }
 
+void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNVPrime;
+	}
+}
+
 float RandomRange(float left, float right)
 {
 	assert(left < right);
 
 	float domainLength = right - left;
-	float random = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX))* domainLength;
-	return left + domainLength;
+	float random = RandomFloat()* domainLength;
+	return left + random;
 }
\ No newline at end of file
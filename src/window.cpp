@@ -20,6 +20,7 @@
 
 #include "raytracer.h"
 #include "utils.h"
+#include "distribution.h"
 #include "samplereditor.h"
 
 #include <thread>
@@ -57,6 +58,42 @@ void TestOrdinalSpeed()
 	spdlog::debug("common is {} branchless is {}", t2-t1, t3-t2);
 }
 
+// the alias table should take the same time per sample whatever the count, the binary search grows with log(count)
+void TestDistributionSpeed()
+{
+	const int sampleCount = 1000000;
+	std::vector<float> us(sampleCount);
+	for (int i = 0; i < sampleCount; i++)
+	{
+		us[i] = RandomFloat();
+	}
+
+	for (int count : { 16, 1024, 65536, 1048576 })
+	{
+		std::vector<float> weights(count);
+		for (int i = 0; i < count; i++)
+		{
+			weights[i] = RandomFloat();
+		}
+		Distribution1D distribution(weights);
+
+		int checksum = 0;
+		auto t1 = glfwGetTime();
+		for (int i = 0; i < sampleCount; i++)
+		{
+			checksum += distribution.Sample(us[i]);
+		}
+		auto t2 = glfwGetTime();
+		for (int i = 0; i < sampleCount; i++)
+		{
+			checksum += distribution.SampleInverse(us[i]);
+		}
+		auto t3 = glfwGetTime();
+
+		spdlog::debug("{} items: alias {}ns binary search {}ns ({})", count, (t2 - t1) * 1e9 / sampleCount, (t3 - t2) * 1e9 / sampleCount, checksum);
+	}
+}
+
 Window::Window(const WindowProperties& InProperties)
 {
     glfwSetErrorCallback(glfw_error_callback);
@@ -67,6 +104,7 @@ Window::Window(const WindowProperties& InProperties)
     }
 
 	//TestOrdinalSpeed();
+	//TestDistributionSpeed();
 
     // Decide GL+GLSL versions
 #if __APPLE__
@@ -210,6 +248,11 @@ void Window::StartUpdate()
 			{
 				rayTracer.Pause();
 			}
+
+			if (ImGui::Button("denoise"))
+			{
+				rayTracer.UpdateDenoisedResult();
+			}
             
             ImGui::End();
         }
@@ -277,6 +320,20 @@ void Window::StartUpdate()
 					ImGui::EndTabItem();
 				}
 
+				if (ImGui::BeginTabItem("Denoised"))
+				{
+					ImGui::Image
+					(
+						(ImTextureID)(intptr_t)filterTexture->Id,
+						ImVec2(filterTexture->Width, filterTexture->Height),
+						ImVec2(0, 0),
+						ImVec2(1, 1),
+						ImVec4(1.0, 1.0, 1.0, 1.0),
+						ImVec4(1.0, 1.0, 1.0, 1.0)
+					);
+					ImGui::EndTabItem();
+				}
+
 				if (ImGui::BeginTabItem("Irradiance"))
 				{
 					ImGui::Image
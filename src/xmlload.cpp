@@ -23,6 +23,7 @@
 #include "lightcomponent.h"
 #include "standardMaterial.h"
 #include "disneyMaterial.h"
+#include "bvh.h"
 //-------------------------------------------------------------------------------
  
 extern Node rootNode;
@@ -35,6 +36,7 @@ extern TexturedColor background;
 extern TexturedColor environment;
 extern TextureList textureList;
 extern LightComList lightList;
+extern BVHBuildSettings bvhBuildSettings;
 
 //-------------------------------------------------------------------------------
  
@@ -47,6 +49,7 @@ extern LightComList lightList;
 //-------------------------------------------------------------------------------
  
 void LoadScene(TiXmlElement *element);
+void LoadBVHSettings(TiXmlElement *element);
 void LoadNode(Node *node, TiXmlElement *element, int level=0);
 void LoadTransform( Transformation *trans, TiXmlElement *element, int level );
 void LoadMaterial(TiXmlElement *element);
@@ -99,8 +102,12 @@ int LoadScene(char const *filename)
     rootNode.Init();
     materials.DeleteAll();
     lights.DeleteAll();
+    lightList.DeleteAll();
+    lightList.clear();
     objList.Clear();
     textureList.Clear();
+    // meshes build their bvh while the scene is parsed, so the settings have to come first
+    LoadBVHSettings( scene->FirstChildElement("bvh") );
     LoadScene( scene );
  
     rootNode.ComputeChildBoundBox();
@@ -185,6 +192,32 @@ void LoadScene(TiXmlElement *element)
 	InitWorldMatrix(&rootNode);
 }
  
+//-------------------------------------------------------------------------------
+
+void LoadBVHSettings(TiXmlElement *element)
+{
+    bvhBuildSettings = BVHBuildSettings();
+    if ( ! element ) return;
+
+    char const* builder = element->Attribute("builder");
+    if ( builder ) {
+        if ( COMPARE(builder,"scanline") ) bvhBuildSettings.method = BVHBuildMethod::ScanLine;
+        else if ( COMPARE(builder,"sah") ) bvhBuildSettings.method = BVHBuildMethod::BinnedSAH;
+        else printf("Unknown bvh builder \"%s\"\n", builder);
+    }
+    char const* layout = element->Attribute("layout");
+    if ( layout ) {
+        if ( COMPARE(layout,"binary") ) bvhBuildSettings.layout = BVHLayout::Binary;
+        else if ( COMPARE(layout,"bvh4") ) bvhBuildSettings.layout = BVHLayout::Wide4;
+        else printf("Unknown bvh layout \"%s\"\n", layout);
+    }
+    element->QueryIntAttribute("bins", &bvhBuildSettings.binCount);
+    element->QueryIntAttribute("leafsize", &bvhBuildSettings.maxLeafSize);
+    element->QueryBoolAttribute("cache", &bvhBuildSettings.useCache);
+
+    printf("BVH builder %s, layout %s, %d bins, leaf size %d\n", bvhBuildSettings.method == BVHBuildMethod::ScanLine ? "scanline" : "sah", bvhBuildSettings.layout == BVHLayout::Wide4 ? "bvh4" : "binary", bvhBuildSettings.binCount, bvhBuildSettings.maxLeafSize);
+}
+ 
 //-------------------------------------------------------------------------------
  
 void LoadNode(Node *parent, TiXmlElement *element, int level)
@@ -221,6 +254,7 @@ void LoadNode(Node *parent, TiXmlElement *element, int level)
 		com->intensity = lightIntensity;
 
 		node->SetLight(com);
+		com->index = (unsigned int)lightList.size();
 		lightList.push_back(com);
 	}
  